@@ -6,7 +6,7 @@
 namespace {
 
 // Determines the set bonuses present in the given FarmedSet.
-int get_set_bonuses(Character& c, FarmedSet& s) {
+int get_set_bonuses(Character& c, const FarmedSet& s) {
   int set_count[SET_CT];
   for (int i = 0; i < SET_CT; i++)
     set_count[i] = 0;
@@ -26,83 +26,240 @@ int get_set_bonuses(Character& c, FarmedSet& s) {
   return two_pc + 3 * four_pc;
 }
 
-}  // namespace
-
-FarmedSetStats analyze_farmed_set(Character& c, std::vector<FarmedSet>& all_max_sets) {
-  // Initialize POD to zero
-  FarmedSetStats stats = {};
+// Number of good substat rolls of the piece: rolls of offensive stats with a stat score
+int count_good_rolls(const FarmingConfig& fcfg, const Artifact& a) {
+  static const std::vector<Stat> POSSIBLE_OFFENSIVE_STATS = {HPP, ATKP, DEFP, EM, CR, CD};
+  int good_rolls = 0;
+  for (int k = 0; k < 4; k++) {
+    const int substat = a.substats[k];
+    if (fcfg.stat_score[substat] > 0
+        && std::find(POSSIBLE_OFFENSIVE_STATS.begin(), POSSIBLE_OFFENSIVE_STATS.end(), substat) != POSSIBLE_OFFENSIVE_STATS.end()) {
+      good_rolls += a.substat_values[substat] / SUBSTAT_LEVEL[substat][0];
+    }
+  }
+  return good_rolls;
+}
 
-  // Sort to easily find quantiles
-  std::sort(all_max_sets.begin(), all_max_sets.end(), [](FarmedSet& s1, FarmedSet& s2) {
-    return s1.damage < s2.damage;
-  });
-  int size = (int) all_max_sets.size();
+}  // namespace
 
-  for (int i = 0; i < 101; i++) {
-    stats.percentiles[i] = all_max_sets[i*size/100].damage;
+FarmedSetAccumulator::FarmedSetAccumulator()
+    : count(0), damage_total(0), good_rolls(0), crit_value(0),
+      importance_sampled(false), weight_total(0.0), weight_sq_total(0.0) {
+  for (int i = 0; i < SLOT_CT; i++) {
+    upgrade_ratio[i][0] = 0;
+    upgrade_ratio[i][1] = 0;
   }
+  for (int i = 0; i < 4; i++)
+    set_bonus_counts[i] = 0;
+}
 
-  // Calculate mean
-  int64_t damage_total = 0;
-  for (int i = 0; i < size; i++)
-    damage_total += all_max_sets[i].damage;
-  stats.mean = double(damage_total) / size;
-
-  // Calculate standard deviation
-  stats.stddev = 0.0;
-  for (int i = 0; i < size; i++) {
-    stats.stddev += (all_max_sets[i].damage - stats.mean) * (all_max_sets[i].damage - stats.mean);
+void FarmedSetAccumulator::add(Character& c, const FarmedSet& s) {
+  count++;
+  damage_histogram[s.damage]++;
+  damage_total += s.damage;
+  if (importance_sampled) {
+    damage_weights[s.damage] += s.weight;
+    weight_total += s.weight;
+    weight_sq_total += s.weight * s.weight;
   }
-  stats.stddev = sqrt(stats.stddev / size);
-
-  // Count average number of good substat rolls and crit value
-  int num_substat_rolls[SUBSTAT_CT];
-  for (int i = 0; i < SUBSTAT_CT; i++)
-    num_substat_rolls[i] = 0;
-  int crit_value = 0;
-  for (int i = 0; i < size; i++) {
-    // Skip incomplete sets and count them as 0 rolls
-    if (all_max_sets[i].damage == 0) continue;
+
+  // Count number of good substat rolls and crit value
+  // Skip incomplete sets and count them as 0 rolls
+  if (s.damage > 0) {
     for (int j = 0; j < SLOT_CT; j++) {
-      Artifact& a = all_max_sets[i].artifacts[j];
-      for (int k = 0; k < 4; k++) {
-        num_substat_rolls[a.substats[k]] += a.substat_values[a.substats[k]] / SUBSTAT_LEVEL[a.substats[k]][0];
-      }
+      const Artifact& a = s.artifacts[j];
+      good_rolls += count_good_rolls(c.farming_config, a);
       crit_value += 2 * a.substat_values[CR] + a.substat_values[CD];
     }
   }
 
-  static const std::vector<Stat> POSSIBLE_OFFENSIVE_STATS = {HPP, ATKP, DEFP, EM, CR, CD};
-  int good_rolls = 0;
-  for (unsigned int i = 0; i < POSSIBLE_OFFENSIVE_STATS.size(); i++) {
-    Stat s = POSSIBLE_OFFENSIVE_STATS[i];
-    if (c.farming_config.stat_score[s] > 0) {
-      good_rolls += num_substat_rolls[s];
+  for (int j = 0; j < SLOT_CT; j++) {
+    upgrade_ratio[j][0] += s.upgrade_ratio[j][0];
+    upgrade_ratio[j][1] += s.upgrade_ratio[j][1];
+  }
+
+  set_bonus_counts[get_set_bonuses(c, s)]++;
+}
+
+void FarmedSetAccumulator::merge(const FarmedSetAccumulator& other) {
+  count += other.count;
+  for (const auto& entry : other.damage_histogram)
+    damage_histogram[entry.first] += entry.second;
+  damage_total += other.damage_total;
+  importance_sampled = importance_sampled || other.importance_sampled;
+  for (const auto& entry : other.damage_weights)
+    damage_weights[entry.first] += entry.second;
+  weight_total += other.weight_total;
+  weight_sq_total += other.weight_sq_total;
+  good_rolls += other.good_rolls;
+  crit_value += other.crit_value;
+  for (int i = 0; i < SLOT_CT; i++) {
+    upgrade_ratio[i][0] += other.upgrade_ratio[i][0];
+    upgrade_ratio[i][1] += other.upgrade_ratio[i][1];
+  }
+  for (int i = 0; i < 4; i++)
+    set_bonus_counts[i] += other.set_bonus_counts[i];
+}
+
+void Histogram::add(int value) {
+  value = std::max(0, value);
+  if (value >= (int) counts.size()) counts.resize(value + 1, 0);
+  counts[value]++;
+}
+
+void Histogram::merge(const Histogram& other) {
+  if (other.counts.size() > counts.size()) counts.resize(other.counts.size(), 0);
+  for (unsigned int i = 0; i < other.counts.size(); i++)
+    counts[i] += other.counts[i];
+}
+
+int64_t Histogram::total() const {
+  int64_t total = 0;
+  for (int64_t count : counts)
+    total += count;
+  return total;
+}
+
+double Histogram::mean() const {
+  int64_t sum = 0;
+  for (unsigned int i = 0; i < counts.size(); i++)
+    sum += i * counts[i];
+  return (double) sum / total();
+}
+
+int Histogram::percentile(double p) const {
+  const int64_t size = total();
+  int64_t seen = 0;
+  for (unsigned int i = 0; i < counts.size(); i++) {
+    seen += counts[i];
+    if (100.0 * seen >= p * size) return i;
+  }
+  return (int) counts.size() - 1;
+}
+
+RollAccumulator::RollAccumulator() : count(0) {
+  for (int i = 0; i < SLOT_CT; i++) {
+    for (int j = 0; j < MAINSTAT_CT; j++)
+      double_crit[i][j] = 0;
+  }
+}
+
+void RollAccumulator::add(FarmingConfig& fcfg, const Artifact& a) {
+  count++;
+  if (a.substat_values[CR] > 0 && a.substat_values[CD] > 0) double_crit[a.slot][a.mainstat]++;
+  crit_value[a.slot][a.mainstat].add(2 * a.substat_values[CR] + a.substat_values[CD]);
+  score[a.slot][a.mainstat].add(fcfg.score(a));
+  good_rolls[a.slot][a.mainstat].add(count_good_rolls(fcfg, a));
+}
+
+void RollAccumulator::merge(const RollAccumulator& other) {
+  count += other.count;
+  for (int i = 0; i < SLOT_CT; i++) {
+    for (int j = 0; j < MAINSTAT_CT; j++) {
+      double_crit[i][j] += other.double_crit[i][j];
+      crit_value[i][j].merge(other.crit_value[i][j]);
+      score[i][j].merge(other.score[i][j]);
+      good_rolls[i][j].merge(other.good_rolls[i][j]);
     }
   }
-  stats.good_rolls = round(100.0 * good_rolls / size) / 100.0;
+}
 
-  stats.crit_value = round(10.0 * crit_value / size) / 10.0 / 10.0;
+FarmedSetStats analyze_farmed_set(Character& c, std::vector<FarmedSet>& all_max_sets) {
+  FarmedSetAccumulator acc;
+  for (const FarmedSet& s : all_max_sets)
+    acc.add(c, s);
+  return analyze_farmed_set(acc);
+}
 
-  // Calculate % of artifacts upgraded
-  for (int i = 0; i < size; i++) {
-    for (int j = 0; j < SLOT_CT; j++) {
-      stats.upgrade_ratio[j][0] += all_max_sets[i].upgrade_ratio[j][0];
-      stats.upgrade_ratio[j][1] += all_max_sets[i].upgrade_ratio[j][1];
+FarmedSetStats analyze_farmed_set(const FarmedSetAccumulator& acc) {
+  // Initialize POD to zero
+  FarmedSetStats stats = {};
+  const int64_t size = acc.count;
+
+  stats.importance_sampled = acc.importance_sampled;
+  if (acc.importance_sampled) {
+    // Weighted quantiles: the smallest damage whose cumulative weight passes the quantile
+    const double total = acc.weight_total;
+    int i = 0;
+    double seen = 0;
+    bool found_99_9 = false;
+    for (const auto& entry : acc.damage_weights) {
+      seen += entry.second;
+      while (i < 101 && i * total / 100 < seen) {
+        stats.percentiles[i] = entry.first;
+        i++;
+      }
+      if (!found_99_9 && 999 * total / 1000 < seen) {
+        stats.percentile_99_9 = entry.first;
+        found_99_9 = true;
+      }
+    }
+    // Rounding can leave the top quantiles without a damage value
+    const int max_damage = acc.damage_weights.rbegin()->first;
+    for (; i < 101; i++)
+      stats.percentiles[i] = max_damage;
+    if (!found_99_9) stats.percentile_99_9 = max_damage;
+
+    // Self-normalized weighted mean and standard deviation
+    stats.mean = 0.0;
+    for (const auto& entry : acc.damage_weights)
+      stats.mean += entry.second * entry.first;
+    stats.mean /= total;
+    stats.stddev = 0.0;
+    for (const auto& entry : acc.damage_weights)
+      stats.stddev += entry.second * (entry.first - stats.mean) * (entry.first - stats.mean);
+    stats.stddev = sqrt(stats.stddev / total);
+    stats.effective_sample_size = total * total / acc.weight_sq_total;
+  } else {
+    // Walk the histogram in increasing order of damage to find quantiles
+    int i = 0;
+    int64_t seen = 0;
+    bool found_99_9 = false;
+    for (const auto& entry : acc.damage_histogram) {
+      seen += entry.second;
+      while (i < 101 && std::min(i * size / 100, size - 1) < seen) {
+        stats.percentiles[i] = entry.first;
+        i++;
+      }
+      if (!found_99_9 && std::min(999 * size / 1000, size - 1) < seen) {
+        stats.percentile_99_9 = entry.first;
+        found_99_9 = true;
+      }
+    }
+
+    // Calculate mean
+    stats.mean = double(acc.damage_total) / size;
+
+    // Calculate standard deviation
+    stats.stddev = 0.0;
+    for (const auto& entry : acc.damage_histogram) {
+      stats.stddev += entry.second * (entry.first - stats.mean) * (entry.first - stats.mean);
     }
+    stats.stddev = sqrt(stats.stddev / size);
+    stats.effective_sample_size = size;
   }
+
+  // Average number of good substat rolls and crit value
+  stats.good_rolls = round(100.0 * acc.good_rolls / size) / 100.0;
+  stats.crit_value = round(10.0 * acc.crit_value / size) / 10.0 / 10.0;
+
+  // Calculate % of artifacts upgraded
   for (int i = 0; i < SLOT_CT; i++) {
+    stats.upgrade_ratio[i][0] = acc.upgrade_ratio[i][0];
+    stats.upgrade_ratio[i][1] = acc.upgrade_ratio[i][1];
     stats.total_upgrade_ratio[0] += stats.upgrade_ratio[i][0];
     stats.total_upgrade_ratio[1] += stats.upgrade_ratio[i][1];
   }
 
   // Calculate set bonus distribution
-  for (int i = 0; i < size; i++) {
-    stats.set_bonus_pcts[get_set_bonuses(c, all_max_sets[i])]++;
-  }
   for (int i = 0; i < 4; i++) {
-    stats.set_bonus_pcts[i] = round(stats.set_bonus_pcts[i] * 10000.0 / size) / 100.0;
+    stats.set_bonus_pcts[i] = round(acc.set_bonus_counts[i] * 10000.0 / size) / 100.0;
   }
 
   return stats;
 }
+
+void shard_iterations(int iters, int shard, int shard_ct, int* begin, int* end) {
+  *begin = (int) ((int64_t) iters * shard / shard_ct);
+  *end = (int) ((int64_t) iters * (shard + 1) / shard_ct);
+}
@@ -1,6 +1,11 @@
 #ifndef __ANALYZE_H__
 #define __ANALYZE_H__
 
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
 #include "farm.h"
 #include "types.h"
 
@@ -9,6 +14,12 @@ struct FarmedSetStats {
   double mean, stddev;
 
   int percentiles[101];
+  int percentile_99_9;
+
+  // Whether the sample was importance sampled, in which case the mean, stddev, and percentiles are
+  // weighted by likelihood ratio, and the number of unweighted samples giving about the same precision
+  bool importance_sampled;
+  double effective_sample_size;
 
   // Good rolls are CR, CD, ATK% (DEF%/HP% for DEF/HP scalers), EM if reaction-based
   double good_rolls;
@@ -27,7 +38,99 @@ struct FarmedSetStats {
   double set_bonus_pcts[4];
 };
 
+// Mergeable sums over a sample of farmed sets, from which FarmedSetStats can be calculated.
+// Everything is stored as integers, so merging accumulators in any order gives identical stats.
+struct FarmedSetAccumulator {
+  int64_t count;
+  // Number of sets achieving each damage value, for exact quantiles
+  std::map<int, int64_t> damage_histogram;
+  int64_t damage_total;
+  int64_t good_rolls;
+  int64_t crit_value;
+  int64_t upgrade_ratio[SLOT_CT][2];
+  // Number of sets with each set bonus combination, indexed like FarmedSetStats::set_bonus_pcts
+  int64_t set_bonus_counts[4];
+
+  // Set before adding importance sampled sets. The likelihood ratios of the sets achieving each damage
+  // value, and the sums of the ratios and their squares, are then added up as well. Being floating
+  // point, they only merge to identical stats up to rounding, and are not stored in shard files.
+  bool importance_sampled;
+  std::map<int, double> damage_weights;
+  double weight_total;
+  double weight_sq_total;
+
+  FarmedSetAccumulator();
+
+  void add(Character& c, const FarmedSet& s);
+  void merge(const FarmedSetAccumulator& other);
+};
+
+// Partial results of one shard of a farm or farm_script run, one accumulator per value of n.
+struct ShardResult {
+  std::string command;
+  std::string character;
+  std::string weapon;
+  uint64_t seed;
+  Generator generator;
+  int iters;
+  int shard;
+  int shard_ct;
+  std::vector<int> n;
+  std::vector<FarmedSetAccumulator> accumulators;
+};
+
+// Progress of a farm_script run. result holds an accumulator for every value of n started so far,
+// with the results of the first count iterations of the shard for that n.
+struct ScriptCheckpoint {
+  ShardResult result;
+  int start_n;
+  int stop_n;
+  int step;
+  bool use_drop_cache;
+  uint64_t drop_cache_seed;
+  // Off (no drops) in checkpoints of older versions
+  BootstrapSettings bootstrap;
+};
+
+// Number of values of a statistic equal to each index, growing to the largest value added, so that
+// its memory depends on the range of the statistic but not on how many values are added.
+struct Histogram {
+  std::vector<int64_t> counts;
+
+  // Negative values are counted as 0
+  void add(int value);
+  void merge(const Histogram& other);
+  int64_t total() const;
+  double mean() const;
+  // Smallest value that at least p percent of the values are at or below. The histogram must not be empty.
+  int percentile(double p) const;
+};
+
+// Mergeable histograms over the artifacts rolled by the roll command, by slot and mainstat, taken
+// as they are rolled instead of storing the artifacts. Everything is stored as integers, so merging
+// accumulators in any order gives identical stats.
+struct RollAccumulator {
+  int64_t count;
+  // Pieces with both crit substats
+  int64_t double_crit[SLOT_CT][MAINSTAT_CT];
+  // 2*CR + CD from substats, FarmingConfig::score, and good rolls like FarmedSetStats::good_rolls.
+  // The totals of each histogram are the number of pieces with the slot and mainstat.
+  Histogram crit_value[SLOT_CT][MAINSTAT_CT];
+  Histogram score[SLOT_CT][MAINSTAT_CT];
+  Histogram good_rolls[SLOT_CT][MAINSTAT_CT];
+
+  RollAccumulator();
+
+  void add(FarmingConfig& fcfg, const Artifact& a);
+  void merge(const RollAccumulator& other);
+};
+
 // Takes a sample of farmed artifacts and returns interesting statistics about the sample.
 FarmedSetStats analyze_farmed_set(Character& c, std::vector<FarmedSet>& all_max_sets);
+// Returns the statistics of an accumulated sample. The sample must not be empty.
+FarmedSetStats analyze_farmed_set(const FarmedSetAccumulator& acc);
+
+// Returns the iterations [begin, end) that shard i of shard_ct runs out of iters.
+void shard_iterations(int iters, int shard, int shard_ct, int* begin, int* end);
 
 #endif
@@ -0,0 +1,50 @@
+#include "bootstrap.h"
+
+#include <cmath>
+
+#include "gen_artifact.h"
+#include "scheduler.h"
+
+void build_bootstrap_pool(const FarmingConfig& fcfg, const BootstrapSettings& settings, uint64_t master_seed,
+                          int threads, BootstrapPool* pool) {
+  pool->settings = settings;
+  pool->master_seed = master_seed;
+  pool->drops.assign(settings.drops * settings.replicates, 0);
+  pool->candidate_idx.assign(settings.drops * settings.replicates, -1);
+  pool->candidates.assign(settings.replicates, std::vector<Artifact>());
+
+  std::vector<WorkStealingScheduler::Task> tasks;
+  for (int r = 0; r < settings.replicates; r++) {
+    tasks.push_back([&fcfg, &settings, master_seed, pool, r](int) {
+      FarmingConfig farming_config = fcfg;
+      farming_config.domain_idx = 0;
+      seed(iteration_seed(~master_seed, r));
+      uint8_t* drops = pool->drops.data() + r * settings.drops;
+      int32_t* candidate_idx = pool->candidate_idx.data() + r * settings.drops;
+      std::vector<Artifact>& candidates = pool->candidates[r];
+      for (int64_t i = 0; i < settings.drops; i++) {
+        Artifact a;
+        gen_random(&a, farming_config);
+        drops[i] = a.slot;
+        if (!farming_config.upgradeable(a)) continue;
+        upgrade_full(&a);
+        drops[i] |= BOOTSTRAP_LEVELED;
+        // Pieces with a useless mainstat never reach the optimizer
+        if (a.slot >= SANDS && farming_config.stat_score[a.mainstat] == 0) continue;
+        a.stat_score = farming_config.score(a);
+        candidate_idx[i] = (int32_t) candidates.size();
+        candidates.push_back(a);
+      }
+    });
+  }
+  WorkStealingScheduler scheduler(threads);
+  scheduler.run(tasks);
+}
+
+double bootstrap_repeat_fraction(int64_t size, int n) {
+  if (n <= 0) return 0.0;
+  if (size <= 1) return 1.0 - 1.0 / n;
+  // Expected number of distinct drops among n draws
+  const double distinct = size * -std::expm1(n * std::log1p(-1.0 / size));
+  return 1.0 - distinct / n;
+}
@@ -0,0 +1,49 @@
+#ifndef __BOOTSTRAP_H__
+#define __BOOTSTRAP_H__
+
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+
+// Replicates of a bootstrap pool unless given
+constexpr int BOOTSTRAP_REPLICATES = 8;
+
+// How a bootstrap run draws the drops of its iterations. Off if drops is 0.
+struct BootstrapSettings {
+  // Drops farmed for each replicate
+  int64_t drops;
+  int replicates;
+  // Whether an iteration takes n consecutive drops from a random start, instead of drawing
+  // n drops with replacement
+  bool windows;
+};
+
+// Drops farmed once, which the iterations of a bootstrap run draw their drops from instead of
+// farming them. The pool consists of independently farmed replicates, and iteration i only draws
+// from replicate i % replicates, so that the spread of the replicates' results shows how much the
+// randomness of the pool itself affects them.
+struct BootstrapPool {
+  BootstrapSettings settings;
+  uint64_t master_seed;
+  // Per replicate and drop, in farming order: the slot, plus BOOTSTRAP_LEVELED if it was leveled
+  std::vector<uint8_t> drops;
+  // Per replicate and drop, the index of the drop in its replicate's candidates, or -1 if it isn't one
+  std::vector<int32_t> candidate_idx;
+  // Per replicate, the scored +20 drops without a useless mainstat
+  std::vector<std::vector<Artifact>> candidates;
+};
+
+constexpr uint8_t BOOTSTRAP_LEVELED = 8;
+
+// Farms every replicate of the pool, from the farming config's domains like farm does, on the given
+// number of threads (one per hardware thread if <= 0). Replicate r is farmed with substream r of the
+// complement of master_seed, which no iteration of a run with master_seed uses.
+void build_bootstrap_pool(const FarmingConfig& fcfg, const BootstrapSettings& settings, uint64_t master_seed,
+                          int threads, BootstrapPool* pool);
+
+// Expected fraction of the n drops of an iteration drawn with replacement from size drops that repeat
+// an earlier draw of the iteration.
+double bootstrap_repeat_fraction(int64_t size, int n);
+
+#endif
@@ -0,0 +1,184 @@
+#include "drop_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "gen_artifact.h"
+#include "text_io.h"
+
+namespace {
+
+// Identifies drop files written by this version of the sim.
+// Must be changed whenever Artifact or artifact generation changes.
+constexpr char DROP_FILE_MAGIC[8] = {'A', 'R', 'T', 'D', 'R', 'O', 'P', '1'};
+// Number of drops generated between file writes
+constexpr int WRITE_CHUNK = 4096;
+// Background jobs may open caches at the same time, and must not write the same file together
+std::mutex open_mutex;
+
+struct DropFileHeader {
+  char magic[8];
+  uint32_t artifact_size;
+  uint32_t domain;
+  uint64_t seed;
+  int64_t size;
+};
+
+std::string drop_file_name(Domain domain, uint64_t seed) {
+  return "cache/drops_" + std::to_string(domain) + "_" + std::to_string(seed) + ".bin";
+}
+
+// Generates size drops from the domain and writes them to its cache file, replacing any existing file.
+bool write_drop_file(Domain domain, uint64_t cache_seed, int64_t size) {
+#ifdef _WIN32
+  _mkdir("cache");
+#else
+  mkdir("cache", 0755);
+#endif
+  // Write to a temporary file first so that no other process maps a partially written file
+  const std::string filename = drop_file_name(domain, cache_seed);
+  const std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream file(tmp_filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+
+    DropFileHeader header = {};
+    std::memcpy(header.magic, DROP_FILE_MAGIC, sizeof(header.magic));
+    header.artifact_size = sizeof(Artifact);
+    header.domain = domain;
+    header.seed = cache_seed;
+    header.size = size;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    seed(iteration_seed(cache_seed, domain));
+    Artifact* chunk = get_artifact_storage(2 * WRITE_CHUNK);
+    for (int64_t i = 0; i < size; i += WRITE_CHUNK) {
+      const int chunk_size = (int) std::min<int64_t>(WRITE_CHUNK, size - i);
+      gen_drops(domain, chunk_size, chunk);
+      file.write(reinterpret_cast<const char*>(chunk), 2 * chunk_size * sizeof(Artifact));
+    }
+    delete[] chunk;
+
+    if (!file.good()) return false;
+  }
+  return replace_file(tmp_filename, filename);
+}
+
+void unmap_drop_stream(DropStream* stream) {
+  if (stream->mapping == nullptr) return;
+#ifdef _WIN32
+  delete[] static_cast<char*>(stream->mapping);
+#else
+  munmap(stream->mapping, stream->mapping_size);
+#endif
+  *stream = {};
+}
+
+// Maps the cache file of the domain into memory. Fails if the file is missing or invalid.
+bool map_drop_stream(Domain domain, uint64_t seed, DropStream* stream) {
+  const std::string filename = drop_file_name(domain, seed);
+#ifdef _WIN32
+  // No mmap, so read the whole file instead
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) return false;
+  const size_t file_size = file.tellg();
+  char* data = new char[file_size];
+  file.seekg(0);
+  file.read(data, file_size);
+  void* mapping = data;
+  if (!file) {
+    delete[] data;
+    return false;
+  }
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return false;
+  }
+  const size_t file_size = file_stat.st_size;
+  void* mapping = (file_size > 0) ? mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+#endif
+  stream->mapping = mapping;
+  stream->mapping_size = file_size;
+
+  const DropFileHeader* header = static_cast<const DropFileHeader*>(mapping);
+  if (file_size < sizeof(DropFileHeader)
+      || std::memcmp(header->magic, DROP_FILE_MAGIC, sizeof(header->magic)) != 0
+      || header->artifact_size != sizeof(Artifact)
+      || header->domain != (uint32_t) domain
+      || header->seed != seed
+      || file_size != sizeof(DropFileHeader) + 2 * header->size * sizeof(Artifact)) {
+    unmap_drop_stream(stream);
+    return false;
+  }
+  stream->drops = reinterpret_cast<const Artifact*>(static_cast<const char*>(mapping) + sizeof(DropFileHeader));
+  stream->size = header->size;
+  return true;
+}
+
+}  // namespace
+
+void gen_drops(Domain domain, int64_t count, Artifact* drops) {
+  for (int64_t i = 0; i < count; i++) {
+    drops[2*i] = Artifact();
+    gen_random(drops + 2*i, domain);
+    // Every drop is leveled so that the stream does not depend on upgrade decisions
+    drops[2*i+1] = drops[2*i];
+    upgrade_full(drops + 2*i+1);
+  }
+}
+
+void drops_per_iteration(const std::vector<Domain>& domains, int n, int64_t* counts) {
+  for (int i = 0; i < DOMAIN_CT; i++)
+    counts[i] = 0;
+  for (int i = 0; i < n; i++)
+    counts[domains[i % domains.size()]]++;
+}
+
+bool open_drop_cache(const std::vector<Domain>& domains, int n, int iters, DropCache* cache) {
+  int64_t counts[DOMAIN_CT];
+  drops_per_iteration(domains, n, counts);
+
+  std::lock_guard<std::mutex> lock(open_mutex);
+  for (int i = 0; i < DOMAIN_CT; i++) {
+    if (counts[i] == 0) continue;
+    const Domain domain = static_cast<Domain>(i);
+    const int64_t required = counts[i] * iters;
+    DropStream& stream = cache->streams[i];
+    if (stream.mapping != nullptr && stream.size >= required) continue;
+
+    unmap_drop_stream(&stream);
+    if (map_drop_stream(domain, cache->seed, &stream) && stream.size >= required) continue;
+
+    unmap_drop_stream(&stream);
+    std::cerr << "Generating " << required << " drops for the artifact cache..." << std::endl;
+    if (!write_drop_file(domain, cache->seed, required) || !map_drop_stream(domain, cache->seed, &stream)) {
+      std::cerr << "Error: failed to write artifact cache file " << drop_file_name(domain, cache->seed) << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+void close_drop_cache(DropCache* cache) {
+  for (int i = 0; i < DOMAIN_CT; i++)
+    unmap_drop_stream(&cache->streams[i]);
+}
@@ -0,0 +1,42 @@
+#ifndef __DROP_CACHE_H__
+#define __DROP_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+
+// A stream of pre-generated drops from one domain. drops[2*i] is the i-th drop at +0,
+// and drops[2*i+1] is the same drop after being leveled to +20.
+struct DropStream {
+  const Artifact* drops;
+  int64_t size;
+
+  // Memory mapping of the cache file backing the stream
+  void* mapping;
+  size_t mapping_size;
+};
+
+// Pre-generated drop streams for every domain, generated from the same seed.
+// Only the streams of farmed domains are opened.
+struct DropCache {
+  uint64_t seed;
+  DropStream streams[DOMAIN_CT];
+};
+
+// Generates count drops from the domain with the calling thread's RNG, in the layout of a DropStream.
+// drops must have room for 2*count artifacts.
+void gen_drops(Domain domain, int64_t count, Artifact* drops);
+
+// Counts the drops that farming n artifacts takes from each domain of the round robin.
+void drops_per_iteration(const std::vector<Domain>& domains, int n, int64_t* counts);
+
+// Makes sure the cache holds enough drops to farm n artifacts iters times from the given domains.
+// Streams are stored in cache/drops_<domain>_<seed>.bin, generated first if missing or too short,
+// and memory mapped read-only. The same domain and seed always give the same stream.
+bool open_drop_cache(const std::vector<Domain>& domains, int n, int iters, DropCache* cache);
+// Unmaps all streams of the cache.
+void close_drop_cache(DropCache* cache);
+
+#endif
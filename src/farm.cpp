@@ -1,10 +1,17 @@
 #include "farm.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
 
 #include "gen_artifact.h"
+#include "gen_batch.h"
+#include "scheduler.h"
 #include "text_io.h"
 
 namespace {
@@ -13,34 +20,24 @@ namespace {
 // good substat rolls than the piece used in the current best set will be skipped.
 constexpr int GOOD_ROLLS_MARGIN = 3;
 
-// Calculate the damage modifier for given character profile and artifacts.
-int calc_damage(Character& c, Weapon& w, int* artifact_stats, int* set_count) {
-  // Aggregate all flat and percentage stats from character, weapon, and artifacts
-  int total_stats[STAT_CT];
-  // Character + weapon stats
-  for (int i = 0; i < STAT_CT; i++)
-    total_stats[i] = c.stats[i] + w.stats[i];
+// Number of average rolls of every substat in the typical set that stat weights are derived at.
+// A +20 set has around 40 substat rolls spread over the 10 substats.
+constexpr int REPRESENTATIVE_ROLLS = 4;
 
-  // Artifact stats
-  for (int i = 0; i < MAINSTAT_CT; i++) {
-    total_stats[i] += artifact_stats[i];
-  }
+// Number of partial sets whose stats are bounded together in the meet in the middle search
+constexpr int BOX_SIZE = 16;
+// Number of flower and feather pairs a thread of the meet in the middle search takes at a time
+constexpr int PAIR_RANGE_SIZE = 16;
 
-  // Set bonuses
-  for (int i = 0; i < SET_CT; i++) {
-    // Only consider bonuses for target sets
-    if (set_count[i] >= 2 && c.farming_config.target_sets[i][TWO_PC]) {
-      StatBonus sb = set_effect(static_cast<Set>(i), TWO_PC);
-      for (int j = 0; j < STAT_CT; j++)
-        total_stats[j] += sb.stats[j];
-    }
-    if (set_count[i] >= 4 && c.farming_config.target_sets[i][FOUR_PC]) {
-      StatBonus sb = set_effect(static_cast<Set>(i), FOUR_PC);
-      for (int j = 0; j < STAT_CT; j++)
-        total_stats[j] += sb.stats[j];
-    }
-  }
+// Threads optimize_set's meet in the middle search uses on this thread, see set_search_threads
+thread_local int search_threads = 1;
+// Optimality gap and evaluation budget of optimize_set on this thread, see set_optimizer_gap
+thread_local double optimizer_gap = 0.0;
+thread_local int64_t optimizer_max_sets = 0;
 
+// Calculate the damage modifier from the total stats of the character, weapon, artifacts, and set bonuses.
+// Never decreases when any (non-negative) stat increases.
+int damage_from_totals(Character& c, Weapon& w, const int* total_stats) {
   // Calculate using ints instead of floats, average error < 0.01%
   int base_atk = c.base_atk + w.base_atk;
   int64_t total_atk = base_atk * (1000 + total_stats[ATKP]) / 1000 + total_stats[ATK];
@@ -55,6 +52,42 @@ int calc_damage(Character& c, Weapon& w, int* artifact_stats, int* set_count) {
   return (int) ((unreacted_fraction + reacted_fraction) / 100000);
 }
 
+// Add the bonuses of the target sets with enough pieces in set_count to total_stats.
+void add_set_bonuses(const FarmingConfig& fcfg, const int* set_count, int* total_stats) {
+  for (int i = 0; i < SET_CT; i++) {
+    // Only consider bonuses for target sets
+    if (set_count[i] >= 2 && fcfg.target_sets[i][TWO_PC]) {
+      StatBonus sb = set_effect(static_cast<Set>(i), TWO_PC);
+      for (int j = 0; j < STAT_CT; j++)
+        total_stats[j] += sb.stats[j];
+    }
+    if (set_count[i] >= 4 && fcfg.target_sets[i][FOUR_PC]) {
+      StatBonus sb = set_effect(static_cast<Set>(i), FOUR_PC);
+      for (int j = 0; j < STAT_CT; j++)
+        total_stats[j] += sb.stats[j];
+    }
+  }
+}
+
+// Calculate the damage modifier for given character profile and artifacts.
+int calc_damage(Character& c, Weapon& w, int* artifact_stats, int* set_count) {
+  // Aggregate all flat and percentage stats from character, weapon, and artifacts
+  int total_stats[STAT_CT];
+  // Character + weapon stats
+  for (int i = 0; i < STAT_CT; i++)
+    total_stats[i] = c.stats[i] + w.stats[i];
+
+  // Artifact stats
+  for (int i = 0; i < MAINSTAT_CT; i++) {
+    total_stats[i] += artifact_stats[i];
+  }
+
+  // Set bonuses
+  add_set_bonuses(c.farming_config, set_count, total_stats);
+
+  return damage_from_totals(c, w, total_stats);
+}
+
 void add_artifact_stats(int* total_stats, Artifact& a) {
   total_stats[a.mainstat] += MAINSTAT_LEVEL[a.mainstat];
   for (int i = 0; i < 4; i++) {
@@ -62,6 +95,68 @@ void add_artifact_stats(int* total_stats, Artifact& a) {
   }
 }
 
+// Amount of a stat given by an artifact's mainstat and substats.
+int artifact_stat(const Artifact& a, int stat) {
+  int value = (a.mainstat == stat) ? MAINSTAT_LEVEL[stat] : 0;
+  if (stat < SUBSTAT_CT) value += a.substat_values[stat];
+  return value;
+}
+
+// A stat constraint translated into bounds on the artifact stats still missing from a partial set.
+struct ConstraintBound {
+  int stat;
+  // Bounds on the artifact total after subtracting character and weapon stats
+  int64_t min, max;
+  // The most and least the slots after each slot can still add
+  int64_t max_after[SLOT_CT], min_after[SLOT_CT];
+};
+
+// Finds the constraints that some combination of the candidates could violate, and the bounds
+// needed to prune partial sets that can no longer satisfy them.
+std::vector<ConstraintBound> constraint_bounds(Character& character, Weapon& weapon,
+                                               Artifact* const* by_slot, const int* size) {
+  std::vector<ConstraintBound> bounds;
+  for (const StatConstraint& constraint : character.farming_config.constraints) {
+    ConstraintBound bound;
+    bound.stat = constraint.stat;
+    const int base = character.stats[constraint.stat] + weapon.stats[constraint.stat];
+    bound.min = (int64_t) constraint.min - base;
+    bound.max = (int64_t) constraint.max - base;
+
+    int64_t slot_max[SLOT_CT], slot_min[SLOT_CT];
+    for (int i = 0; i < SLOT_CT; i++) {
+      slot_max[i] = 0;
+      slot_min[i] = 0;
+      for (int j = 0; j < size[i]; j++) {
+        const int value = artifact_stat(by_slot[i][j], constraint.stat);
+        slot_max[i] = (j == 0) ? value : std::max<int64_t>(slot_max[i], value);
+        slot_min[i] = (j == 0) ? value : std::min<int64_t>(slot_min[i], value);
+      }
+    }
+    bound.max_after[SLOT_CT-1] = 0;
+    bound.min_after[SLOT_CT-1] = 0;
+    for (int i = SLOT_CT-2; i >= 0; i--) {
+      bound.max_after[i] = bound.max_after[i+1] + slot_max[i+1];
+      bound.min_after[i] = bound.min_after[i+1] + slot_min[i+1];
+    }
+    // Skip constraints that every set satisfies
+    const int64_t most = bound.max_after[0] + slot_max[0], least = bound.min_after[0] + slot_min[0];
+    if (least >= bound.min && most <= bound.max) continue;
+    bounds.push_back(bound);
+  }
+  return bounds;
+}
+
+// Returns whether adding a to the partial set in artifact_stats, which fills the slots before
+// a's slot, can still be completed into a set satisfying every constraint.
+bool feasible(const std::vector<ConstraintBound>& bounds, const int* artifact_stats, const Artifact& a) {
+  for (const ConstraintBound& bound : bounds) {
+    const int64_t total = artifact_stats[bound.stat] + artifact_stat(a, bound.stat);
+    if (total + bound.max_after[a.slot] < bound.min || total + bound.min_after[a.slot] > bound.max) return false;
+  }
+  return true;
+}
+
 void subtract_artifact_stats(int* total_stats, Artifact& a) {
   total_stats[a.mainstat] -= MAINSTAT_LEVEL[a.mainstat];
   for (int i = 0; i < 4; i++) {
@@ -69,43 +164,753 @@ void subtract_artifact_stats(int* total_stats, Artifact& a) {
   }
 }
 
-}  // namespace
+// A stat that can change the damage of a set or whether it satisfies the constraints, with the
+// sign that makes more of it better for the set.
+struct Dimension {
+  int stat;
+  int sign;
+};
 
-FarmedSet farm(Character& character, Weapon& weapon, int n) {
-  FarmingConfig& farming_config = character.farming_config;
-  FarmedSet max_set;
+// Finds the dimensions that partial sets are compared on when removing dominated ones.
+std::vector<Dimension> dominance_dimensions(const Character& character) {
+  std::vector<Dimension> dims = {{ATK, 1}, {ATKP, 1}, {CR, 1}, {CD, 1}, {ON_ELE, 1}};
+  if (character.reaction_percentage > 0) dims.push_back({EM, 1});
+  for (const StatConstraint& constraint : character.farming_config.constraints) {
+    if (constraint.min != std::numeric_limits<int>::min()) {
+      bool present = false;
+      for (const Dimension& dim : dims)
+        present |= (dim.stat == constraint.stat && dim.sign == 1);
+      if (!present) dims.push_back({constraint.stat, 1});
+    }
+    if (constraint.max != std::numeric_limits<int>::max()) dims.push_back({constraint.stat, -1});
+  }
+  return dims;
+}
 
-  // Step 1: Generate n artifacts
-  Artifact* all_artis = get_artifact_storage(n);
+// One or two pieces of a set from the meet in the middle search.
+struct PartialSet {
+  int stats[MAINSTAT_CT];
+  // Target sets of the pieces in ascending order, NONE for pieces of other sets, whose
+  // bonuses never count
+  Set sets[2];
+  // Mainstats of the pieces, as mainstat or first * MAINSTAT_CT + second
+  int mainstats;
+  // Index of the PartialGroup it belongs to
+  int group;
+  // Indices of the pieces in their slots
+  int pieces[2];
+  // Upper bound on the damage of any complete set containing the pieces
+  int bound;
+};
+
+Set target_set(const FarmingConfig& fcfg, Set s) {
+  return (fcfg.target_sets[s][TWO_PC] || fcfg.target_sets[s][FOUR_PC]) ? s : NONE;
+}
+
+// Returns the candidates of one slot as partial sets.
+std::vector<PartialSet> single_pieces(const FarmingConfig& fcfg, Artifact* pieces, int size) {
+  std::vector<PartialSet> singles(size);
+  for (int i = 0; i < size; i++) {
+    PartialSet& single = singles[i];
+    std::fill(single.stats, single.stats + MAINSTAT_CT, 0);
+    add_artifact_stats(single.stats, pieces[i]);
+    single.sets[0] = NONE;
+    single.sets[1] = target_set(fcfg, pieces[i].set);
+    single.mainstats = pieces[i].mainstat;
+    single.pieces[0] = i;
+    single.pieces[1] = -1;
+  }
+  return singles;
+}
+
+// Returns every combination of a partial set from first and one from second.
+std::vector<PartialSet> combine_pieces(const std::vector<PartialSet>& first, const std::vector<PartialSet>& second) {
+  std::vector<PartialSet> pairs;
+  pairs.reserve(first.size() * second.size());
+  for (const PartialSet& a : first) {
+    for (const PartialSet& b : second) {
+      PartialSet pair;
+      for (int i = 0; i < MAINSTAT_CT; i++)
+        pair.stats[i] = a.stats[i] + b.stats[i];
+      pair.sets[0] = std::min(a.sets[1], b.sets[1]);
+      pair.sets[1] = std::max(a.sets[1], b.sets[1]);
+      pair.mainstats = a.mainstats * MAINSTAT_CT + b.mainstats;
+      pair.pieces[0] = a.pieces[0];
+      pair.pieces[1] = b.pieces[0];
+      pairs.push_back(pair);
+    }
+  }
+  return pairs;
+}
+
+// Removes the partial sets that another one with the same target sets is at least as good as in every
+// dimension, keeping one of each group of equal ones. Swapping a dominated partial set for the one
+// dominating it never lowers damage or breaks a constraint, so the best set is never removed.
+void remove_dominated(std::vector<PartialSet>* partials, const std::vector<Dimension>& dims) {
+  // Within each group of target sets, a partial set can only be dominated by one with a greater or
+  // equal sum over the dimensions, which comes before it
+  std::vector<std::pair<int64_t, int>> order(partials->size());
+  for (unsigned int i = 0; i < partials->size(); i++) {
+    const PartialSet& p = (*partials)[i];
+    int64_t sum = 0;
+    for (const Dimension& dim : dims)
+      sum += dim.sign * p.stats[dim.stat];
+    order[i] = {sum, (int) i};
+  }
+  std::sort(order.begin(), order.end(), [partials](const std::pair<int64_t, int>& x, const std::pair<int64_t, int>& y) {
+    const PartialSet& a = (*partials)[x.second];
+    const PartialSet& b = (*partials)[y.second];
+    if (a.sets[0] != b.sets[0]) return a.sets[0] < b.sets[0];
+    if (a.sets[1] != b.sets[1]) return a.sets[1] < b.sets[1];
+    if (x.first != y.first) return x.first > y.first;
+    return x.second < y.second;
+  });
+
+  std::vector<PartialSet> kept;
+  unsigned int group_start = 0;
+  for (const std::pair<int64_t, int>& entry : order) {
+    const PartialSet& p = (*partials)[entry.second];
+    if (!kept.empty() && (kept.back().sets[0] != p.sets[0] || kept.back().sets[1] != p.sets[1]))
+      group_start = kept.size();
+    bool dominated = false;
+    for (unsigned int i = group_start; i < kept.size() && !dominated; i++) {
+      dominated = true;
+      for (const Dimension& dim : dims) {
+        if (dim.sign * kept[i].stats[dim.stat] < dim.sign * p.stats[dim.stat]) {
+          dominated = false;
+          break;
+        }
+      }
+    }
+    if (!dominated) kept.push_back(p);
+  }
+  partials->swap(kept);
+}
+
+// The partial sets of one part of the set with the same mainstats and target sets, with the most of every
+// stat among them.
+struct PartialGroup {
+  // A run of members [begin, end) with the most of every stat among them
+  struct Box {
+    int begin, end;
+    int stats[MAINSTAT_CT];
+  };
+
+  int mainstats;
+  Set sets[2];
+  int stats[MAINSTAT_CT];
+  std::vector<PartialSet> members;
+  // The members in runs of BOX_SIZE, in the order of their bounds
+  std::vector<Box> boxes;
+};
+
+// Groups the partial sets by mainstats and target sets.
+std::vector<PartialGroup> group_partials(const std::vector<PartialSet>& partials) {
+  std::vector<PartialGroup> groups;
+  for (const PartialSet& p : partials) {
+    auto it = std::find_if(groups.begin(), groups.end(), [&p](const PartialGroup& g) {
+      return g.mainstats == p.mainstats && g.sets[0] == p.sets[0] && g.sets[1] == p.sets[1];
+    });
+    if (it == groups.end()) {
+      groups.push_back(PartialGroup());
+      it = groups.end() - 1;
+      it->mainstats = p.mainstats;
+      it->sets[0] = p.sets[0];
+      it->sets[1] = p.sets[1];
+      std::fill(it->stats, it->stats + MAINSTAT_CT, 0);
+    }
+    for (int i = 0; i < MAINSTAT_CT; i++)
+      it->stats[i] = std::max(it->stats[i], p.stats[i]);
+    it->members.push_back(p);
+    it->members.back().group = it - groups.begin();
+  }
+  return groups;
+}
+
+// Character and weapon stats plus the set bonuses of every combination of groups from the three parts,
+// indexed by the group of each part. Adding the artifact stats of a set gives its total stats.
+struct FixedStats {
+  std::vector<StatBonus> stats;
+  int groups[3];
+
+  FixedStats(Character& c, Weapon& w, const std::vector<PartialGroup>* parts) {
+    for (int i = 0; i < 3; i++)
+      groups[i] = parts[i].size();
+    stats.resize(groups[0] * groups[1] * groups[2]);
+    for (int i = 0; i < groups[0]; i++) {
+      for (int j = 0; j < groups[1]; j++) {
+        for (int k = 0; k < groups[2]; k++) {
+          int set_count[SET_CT];
+          for (int s = 0; s < SET_CT; s++)
+            set_count[s] = 0;
+          for (int s = 0; s < 2; s++) {
+            set_count[parts[0][i].sets[s]]++;
+            set_count[parts[1][j].sets[s]]++;
+            set_count[parts[2][k].sets[s]]++;
+          }
+          int* total_stats = at(i, j, k).stats;
+          for (int s = 0; s < STAT_CT; s++)
+            total_stats[s] = c.stats[s] + w.stats[s];
+          add_set_bonuses(c.farming_config, set_count, total_stats);
+        }
+      }
+    }
+  }
+  StatBonus& at(int i, int j, int k) { return stats[(i * groups[1] + j) * groups[2] + k]; }
+  const StatBonus& at(const int* group) const { return stats[(group[0] * groups[1] + group[1]) * groups[2] + group[2]]; }
+};
+
+// Damage of a set with the given artifact stats and fixed stats. As damage never decreases when a
+// stat increases, this is an upper bound when the artifact stats are upper bounds.
+int partial_damage(Character& c, Weapon& w, const StatBonus& fixed, const int* artifact_stats) {
+  int total_stats[STAT_CT];
+  for (int i = 0; i < STAT_CT; i++)
+    total_stats[i] = fixed.stats[i] + (i < MAINSTAT_CT ? artifact_stats[i] : 0);
+  return damage_from_totals(c, w, total_stats);
+}
+
+// Upper bound on the damage of a set made of stats from the given group of one part, and one group from
+// each of the other two parts.
+int completion_bound(Character& c, Weapon& w, const FixedStats& fixed, const std::vector<PartialGroup>* parts,
+                     int part, int group, const int* stats) {
+  const int x = (part + 1) % 3, y = (part + 2) % 3;
+  int index[3];
+  index[part] = group;
+  int bound = 0;
+  int total[MAINSTAT_CT];
+  for (index[x] = 0; index[x] < fixed.groups[x]; index[x]++) {
+    for (index[y] = 0; index[y] < fixed.groups[y]; index[y]++) {
+      const int* x_stats = parts[x][index[x]].stats;
+      const int* y_stats = parts[y][index[y]].stats;
+      for (int i = 0; i < MAINSTAT_CT; i++)
+        total[i] = stats[i] + x_stats[i] + y_stats[i];
+      bound = std::max(bound, partial_damage(c, w, fixed.at(index), total));
+    }
+  }
+  return bound;
+}
+
+// Bounds every member of a part by completing it with the other two parts, sorts each group
+// from highest to lowest bound, and splits it into boxes.
+void bound_members(Character& c, Weapon& w, const FixedStats& fixed, std::vector<PartialGroup>* parts, int part) {
+  for (unsigned int g = 0; g < parts[part].size(); g++) {
+    std::vector<PartialSet>& members = parts[part][g].members;
+    for (PartialSet& p : members)
+      p.bound = completion_bound(c, w, fixed, parts, part, g, p.stats);
+    std::sort(members.begin(), members.end(), [](const PartialSet& a, const PartialSet& b) {
+      return a.bound > b.bound;
+    });
+
+    std::vector<PartialGroup::Box>& boxes = parts[part][g].boxes;
+    for (unsigned int begin = 0; begin < members.size(); begin += BOX_SIZE) {
+      PartialGroup::Box box;
+      box.begin = begin;
+      box.end = std::min<int>(members.size(), begin + BOX_SIZE);
+      std::fill(box.stats, box.stats + MAINSTAT_CT, 0);
+      for (int j = box.begin; j < box.end; j++) {
+        for (int i = 0; i < MAINSTAT_CT; i++)
+          box.stats[i] = std::max(box.stats[i], members[j].stats[i]);
+      }
+      boxes.push_back(box);
+    }
+  }
+}
+
+// The parts of a meet in the middle search, read by every thread searching it.
+struct MiddleSearch {
+  Character& character;
+  Weapon& weapon;
+  const FixedStats& fixed;
+  // Flower and feather pairs from highest to lowest bound
+  const std::vector<PartialSet>& first_pairs;
+  const std::vector<PartialGroup>& second;
+  const std::vector<PartialGroup>& circlets;
+  // Constraints on the artifact totals, and the least and most of each constrained stat a circlet adds
+  const std::vector<StatConstraint>& constraints;
+  const int64_t* circlet_min;
+  const int64_t* circlet_max;
+  // Sets within gap of the best set are skipped, and the search stops once about max_sets sets have
+  // been evaluated if max_sets > 0, counting them in evaluated. See set_optimizer_gap.
+  double gap;
+  int64_t max_sets;
+  std::atomic<int64_t>* evaluated;
+};
+
+// The best set found from a range of flower and feather pairs.
+struct RangeBest {
+  int damage;
+  PartialSet sets[3];
+  int64_t leaf_sets;
+  // Largest upper bound of the sets skipped without being evaluated
+  int skipped_bound;
+
+  RangeBest() : damage(0), leaf_sets(0), skipped_bound(0) {}
+};
+
+// Searches the sets made with the flower and feather pairs [begin, end), keeping the first set found
+// with the most damage in result. Sets that can't beat the range's best set are skipped, as are sets
+// that can't reach incumbent, the most damage found by any range. Sets only tying incumbent are still
+// searched, so that the first range with the most damage has the same set as searching every range
+// in order, whatever order the ranges are searched in.
+// With a gap, sets whose bound is within the gap of the range's best set or incumbent are skipped too.
+void search_pair_range(const MiddleSearch& search, int begin, int end, std::atomic<int>* incumbent,
+                       RangeBest* result) {
+  Character& character = search.character;
+  Weapon& weapon = search.weapon;
+  const std::vector<PartialGroup>& second = search.second;
+  const std::vector<PartialGroup>& circlets = search.circlets;
+  int best_damage = 0;
+  // Damage a set must exceed to be searched
+  int skip_damage = 0;
+  auto update_skip_damage = [&search, &best_damage, &skip_damage, incumbent]() {
+    const int shared = incumbent->load(std::memory_order_relaxed);
+    skip_damage = (search.gap > 0) ? (int) (std::max(best_damage, shared) / (1.0 - search.gap))
+                                   : std::max(best_damage, shared - 1);
+  };
+  int skipped_bound = 0;
+  auto skip = [&skipped_bound](int bound) { skipped_bound = std::max(skipped_bound, bound); };
+  int64_t leaf_sets = 0, counted_sets = 0;
+  auto budget_spent = [&search, &leaf_sets, &counted_sets]() {
+    if (search.max_sets <= 0) return false;
+    search.evaluated->fetch_add(leaf_sets - counted_sets, std::memory_order_relaxed);
+    counted_sets = leaf_sets;
+    return search.evaluated->load(std::memory_order_relaxed) >= search.max_sets;
+  };
+  int stats[MAINSTAT_CT], total[MAINSTAT_CT];
+  int group[3];
+  // Circlet boxes that could still complete a flower, feather, sands, and goblet box into a better set
+  std::vector<std::pair<int, const PartialGroup::Box*>> circlet_boxes;
+  for (int p = begin; p < end; p++) {
+    const PartialSet& a = search.first_pairs[p];
+    update_skip_damage();
+    // The remaining pairs are bounded by this one's bound
+    if (a.bound <= skip_damage || budget_spent()) {
+      skip(a.bound);
+      break;
+    }
+    group[0] = a.group;
+    bool out_of_budget = false;
+    for (group[1] = 0; group[1] < (int) second.size() && !out_of_budget; group[1]++) {
+      const PartialGroup& second_group = second[group[1]];
+      for (const PartialGroup::Box& second_box : second_group.boxes) {
+        update_skip_damage();
+        if (second_group.members[second_box.begin].bound <= skip_damage) {
+          skip(second_group.members[second_box.begin].bound);
+          break;
+        }
+        // The rest of the pair is bounded by its bound, and the remaining pairs by theirs
+        if (budget_spent()) {
+          skip(a.bound);
+          out_of_budget = true;
+          break;
+        }
+        circlet_boxes.clear();
+        for (group[2] = 0; group[2] < (int) circlets.size(); group[2]++) {
+          for (const PartialGroup::Box& circlet_box : circlets[group[2]].boxes) {
+            for (int i = 0; i < MAINSTAT_CT; i++)
+              total[i] = a.stats[i] + second_box.stats[i] + circlet_box.stats[i];
+            const int box_bound = partial_damage(character, weapon, search.fixed.at(group), total);
+            if (box_bound > skip_damage) {
+              circlet_boxes.push_back({group[2], &circlet_box});
+            } else {
+              skip(box_bound);
+            }
+          }
+        }
+
+        for (int j = second_box.begin; j < second_box.end; j++) {
+          const PartialSet& b = second_group.members[j];
+          if (b.bound <= skip_damage) {
+            skip(b.bound);
+            break;
+          }
+          for (int i = 0; i < MAINSTAT_CT; i++)
+            stats[i] = a.stats[i] + b.stats[i];
+          bool feasible_pair = true;
+          for (const StatConstraint& constraint : search.constraints) {
+            feasible_pair &= (stats[constraint.stat] + search.circlet_max[constraint.stat] >= constraint.min
+                              && stats[constraint.stat] + search.circlet_min[constraint.stat] <= constraint.max);
+          }
+          if (!feasible_pair) continue;
+
+          for (const std::pair<int, const PartialGroup::Box*>& circlet_box : circlet_boxes) {
+            group[2] = circlet_box.first;
+            const StatBonus& fixed_stats = search.fixed.at(group);
+            for (int i = 0; i < MAINSTAT_CT; i++)
+              total[i] = stats[i] + circlet_box.second->stats[i];
+            const int box_bound = partial_damage(character, weapon, fixed_stats, total);
+            if (box_bound <= skip_damage) {
+              skip(box_bound);
+              continue;
+            }
+
+            for (int k = circlet_box.second->begin; k < circlet_box.second->end; k++) {
+              const PartialSet& c = circlets[group[2]].members[k];
+              if (c.bound <= skip_damage) {
+                skip(c.bound);
+                break;
+              }
+              bool feasible_set = true;
+              for (const StatConstraint& constraint : search.constraints) {
+                const int64_t value = stats[constraint.stat] + c.stats[constraint.stat];
+                feasible_set &= (value >= constraint.min && value <= constraint.max);
+              }
+              if (!feasible_set) continue;
+
+              for (int i = 0; i < MAINSTAT_CT; i++)
+                total[i] = stats[i] + c.stats[i];
+              const int damage = partial_damage(character, weapon, fixed_stats, total);
+              leaf_sets++;
+              if (damage > best_damage) {
+                best_damage = damage;
+                skip_damage = std::max(skip_damage, damage);
+                result->sets[0] = a;
+                result->sets[1] = b;
+                result->sets[2] = c;
+                int shared = incumbent->load(std::memory_order_relaxed);
+                while (damage > shared && !incumbent->compare_exchange_weak(shared, damage, std::memory_order_relaxed)) {}
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  result->damage = best_damage;
+  result->leaf_sets = leaf_sets;
+  result->skipped_bound = skipped_bound;
+}
+
+// Finds the set with the most damage by splitting it into flower+feather pairs, sands+goblet pairs, and
+// circlets. Dominated pieces and pairs are removed, and the rest are combined in order of an upper bound
+// on their damage, computed from the most of each stat that the other parts can add with each choice of
+// mainstats and sets. Sands+goblet pairs and circlets are also bounded in boxes, so that whole boxes of
+// combinations that can't beat the best set found are skipped at once. Finds a set with the same damage
+// as checking every combination, but evaluates a small fraction of them.
+//
+// With a gap or max_sets (see set_optimizer_gap), sets are only searched for if they beat the set
+// already in result by more than the gap, and result->damage_bound is the largest bound of any set skipped.
+void meet_in_the_middle(Character& character, Weapon& weapon, Artifact* const* by_slot, const int* size,
+                        double gap, int64_t max_sets, FarmedSet* result) {
+  const FarmingConfig& fcfg = character.farming_config;
+  for (int i = 0; i < SLOT_CT; i++) {
+    if (size[i] == 0) return;
+  }
+
+  const std::vector<Dimension> dims = dominance_dimensions(character);
+  std::vector<PartialSet> singles[SLOT_CT];
+  for (int i = 0; i < SLOT_CT; i++) {
+    singles[i] = single_pieces(fcfg, by_slot[i], size[i]);
+    remove_dominated(&singles[i], dims);
+  }
+  // The sands and goblet pairs are independent of the flower and feather pairs, so build them at the same time
+  std::vector<PartialSet> first_pairs, second_pairs;
+  auto build_second_pairs = [&singles, &dims, &second_pairs]() {
+    second_pairs = combine_pieces(singles[SANDS], singles[GOBLET]);
+    remove_dominated(&second_pairs, dims);
+  };
+  std::thread second_builder;
+  if (search_threads == 1) {
+    build_second_pairs();
+  } else {
+    second_builder = std::thread(build_second_pairs);
+  }
+  first_pairs = combine_pieces(singles[FLOWER], singles[FEATHER]);
+  remove_dominated(&first_pairs, dims);
+  if (second_builder.joinable()) second_builder.join();
+
+  std::vector<PartialGroup> parts[3] = {group_partials(first_pairs), group_partials(second_pairs),
+                                        group_partials(singles[CIRCLET])};
+  const FixedStats fixed(character, weapon, parts);
+  for (int i = 0; i < 3; i++)
+    bound_members(character, weapon, fixed, parts, i);
+  const std::vector<PartialGroup>& first = parts[0];
+  const std::vector<PartialGroup>& second = parts[1];
+  const std::vector<PartialGroup>& circlets = parts[2];
+  // The outer loop goes over all flower and feather pairs at once, so that it can stop at the first
+  // pair whose bound can't beat the best set
+  first_pairs.clear();
+  for (const PartialGroup& group : first)
+    first_pairs.insert(first_pairs.end(), group.members.begin(), group.members.end());
+  std::sort(first_pairs.begin(), first_pairs.end(), [](const PartialSet& a, const PartialSet& b) {
+    return a.bound > b.bound;
+  });
+
+  // Constraints are checked on the artifact totals left after character and weapon stats
+  std::vector<StatConstraint> constraints = fcfg.constraints;
+  int64_t circlet_min[MAINSTAT_CT], circlet_max[MAINSTAT_CT];
+  for (StatConstraint& constraint : constraints) {
+    const int base = character.stats[constraint.stat] + weapon.stats[constraint.stat];
+    if (constraint.min != std::numeric_limits<int>::min()) constraint.min -= base;
+    if (constraint.max != std::numeric_limits<int>::max()) constraint.max -= base;
+    circlet_min[constraint.stat] = singles[CIRCLET][0].stats[constraint.stat];
+    circlet_max[constraint.stat] = singles[CIRCLET][0].stats[constraint.stat];
+    for (const PartialSet& c : singles[CIRCLET]) {
+      circlet_min[constraint.stat] = std::min<int64_t>(circlet_min[constraint.stat], c.stats[constraint.stat]);
+      circlet_max[constraint.stat] = std::max<int64_t>(circlet_max[constraint.stat], c.stats[constraint.stat]);
+    }
+  }
+
+  std::atomic<int64_t> evaluated(0);
+  const bool approximate = gap > 0 || max_sets > 0;
+  const MiddleSearch search = {character, weapon, fixed, first_pairs, second, circlets, constraints,
+                               circlet_min, circlet_max, gap, max_sets, &evaluated};
+  // Split the flower and feather pairs into ranges, searched by the workers in order of their bounds.
+  // Every range keeps its own best set, and they all skip sets that can't reach the best damage
+  // of any range, shared through incumbent.
+  std::atomic<int> incumbent(approximate ? result->damage : 0);
+  std::vector<RangeBest> ranges((first_pairs.size() + PAIR_RANGE_SIZE - 1) / PAIR_RANGE_SIZE);
+  if (search_threads == 1 || ranges.size() <= 1) {
+    ranges.resize(1);
+    search_pair_range(search, 0, (int) first_pairs.size(), &incumbent, &ranges[0]);
+  } else {
+    std::vector<WorkStealingScheduler::Task> tasks;
+    for (unsigned int r = 0; r < ranges.size(); r++) {
+      tasks.push_back([&search, &incumbent, &ranges, &first_pairs, r](int) {
+        const int begin = r * PAIR_RANGE_SIZE;
+        search_pair_range(search, begin, std::min<int>(first_pairs.size(), begin + PAIR_RANGE_SIZE), &incumbent,
+                          &ranges[r]);
+      });
+    }
+    WorkStealingScheduler scheduler(search_threads);
+    scheduler.run(tasks);
+  }
+
+  // The first range with the most damage holds the set the serial search would find
+  const RangeBest* best = &ranges[0];
+  int skipped_bound = 0;
+  for (const RangeBest& range : ranges) {
+    result->leaf_sets += range.leaf_sets;
+    skipped_bound = std::max(skipped_bound, range.skipped_bound);
+    if (range.damage > best->damage) best = &range;
+  }
+  if (approximate) result->damage_bound = std::max(skipped_bound, std::max(result->damage, best->damage));
+  if (best->damage == 0 || (approximate && best->damage <= result->damage)) return;
+  result->damage = best->damage;
+  result->artifacts[FLOWER] = by_slot[FLOWER][best->sets[0].pieces[0]];
+  result->artifacts[FEATHER] = by_slot[FEATHER][best->sets[0].pieces[1]];
+  result->artifacts[SANDS] = by_slot[SANDS][best->sets[1].pieces[0]];
+  result->artifacts[GOBLET] = by_slot[GOBLET][best->sets[1].pieces[1]];
+  result->artifacts[CIRCLET] = by_slot[CIRCLET][best->sets[2].pieces[0]];
+}
+
+// Starts from the piece with the highest stat score of each slot, and swaps one piece at a time for
+// the one adding the most damage while that improves the set, or makes it satisfy the constraints.
+// Stores the set in result if it satisfies the constraints. by_slot must be sorted by stat score.
+void local_search(Character& character, Weapon& weapon, Artifact* const* by_slot, const int* size,
+                  FarmedSet* result) {
+  Artifact set[SLOT_CT];
+  for (int i = 0; i < SLOT_CT; i++) {
+    if (size[i] == 0) return;
+    set[i] = by_slot[i][0];
+  }
+  // Infeasible sets are worse than any feasible one
+  auto value = [&character, &weapon](const Artifact* s) {
+    return satisfies_constraints(character, weapon, s) ? set_damage(character, weapon, s) : -1;
+  };
+  int damage = value(set);
+  bool improved = true;
+  while (improved) {
+    improved = false;
+    for (int slot = 0; slot < SLOT_CT; slot++) {
+      const Artifact current = set[slot];
+      int best_piece = -1;
+      for (int i = 0; i < size[slot]; i++) {
+        set[slot] = by_slot[slot][i];
+        const int swapped = value(set);
+        result->leaf_sets++;
+        if (swapped > damage) {
+          damage = swapped;
+          best_piece = i;
+        }
+      }
+      set[slot] = (best_piece >= 0) ? by_slot[slot][best_piece] : current;
+      improved |= (best_piece >= 0);
+    }
+  }
+  if (damage <= 0) return;
+  result->damage = damage;
+  std::copy(set, set + SLOT_CT, result->artifacts);
+}
+
+// State of a depth first search over the sets that can be made from by_slot, which stops at
+// pieces that can't beat the best set found so far.
+struct SetSearch {
+  Character& character;
+  Weapon& weapon;
+  Artifact* const* by_slot;
+  const int* size;
+  std::vector<ConstraintBound> bounds;
+  // Whether pieces are skipped with the same GOOD_ROLLS_MARGIN pruning as optimize_set.
+  // Without it, every feasible set is evaluated.
+  bool margin_pruning;
+  int artifact_stats[MAINSTAT_CT];
+  int set_count[SET_CT];
+  int pieces[SLOT_CT];
+  FarmedSet* best;
+};
+
+// Try every piece of the slot and the slots after it, replacing the best set with any set that beats it.
+void search_sets(SetSearch& search, int slot) {
+  const FarmingConfig& farming_config = search.character.farming_config;
+  FarmedSet& best = *search.best;
+  for (int i = 0; i < search.size[slot]; i++) {
+    Artifact& a = search.by_slot[slot][i];
+    if (search.margin_pruning
+        && a.stat_score <= best.artifacts[slot].stat_score - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+    if (!feasible(search.bounds, search.artifact_stats, a)) continue;
+    add_artifact_stats(search.artifact_stats, a);
+    search.set_count[a.set]++;
+    search.pieces[slot] = i;
+
+    if (slot < SLOT_CT - 1) {
+      search_sets(search, slot + 1);
+    } else {
+      const int damage = calc_damage(search.character, search.weapon, search.artifact_stats, search.set_count);
+      best.leaf_sets++;
+      if (damage > best.damage) {
+        best.damage = damage;
+        for (int j = 0; j < SLOT_CT; j++)
+          best.artifacts[j] = search.by_slot[j][search.pieces[j]];
+      }
+    }
+
+    subtract_artifact_stats(search.artifact_stats, a);
+    search.set_count[a.set]--;
+  }
+}
+
+// Add a new +20 piece to the inventory in by_slot and update the best set of the inventory. Only the
+// sets containing the new piece are searched, so every set is evaluated once, when its last piece arrives.
+void add_to_best_set(Character& character, Weapon& weapon, Artifact piece, std::vector<Artifact>* by_slot,
+                     FarmedSet* best) {
+  const FarmingConfig& farming_config = character.farming_config;
+  const int slot = piece.slot;
+  // Keep each slot sorted from greatest to least score, so that the best sets are found early
+  by_slot[slot].insert(std::upper_bound(by_slot[slot].begin(), by_slot[slot].end(), piece,
+                                        [](const Artifact& a, const Artifact& b) { return a.stat_score > b.stat_score; }),
+                       piece);
+  if (piece.stat_score <= best->artifacts[slot].stat_score - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) return;
+  for (int i = 0; i < SLOT_CT; i++) {
+    if (i != slot && by_slot[i].empty()) return;
+  }
+
+  Artifact* slot_pieces[SLOT_CT];
+  int size[SLOT_CT];
+  for (int i = 0; i < SLOT_CT; i++) {
+    slot_pieces[i] = by_slot[i].data();
+    size[i] = (int) by_slot[i].size();
+  }
+  slot_pieces[slot] = &piece;
+  size[slot] = 1;
+
+  SetSearch search = {character, weapon, slot_pieces, size, constraint_bounds(character, weapon, slot_pieces, size),
+                      true, {}, {}, {}, best};
+  search_sets(search, 0);
+}
+
+// Generate n artifacts, leveling the ones that pass min_stat_score, and score them.
+void farm_artifacts(FarmingConfig& farming_config, int n, Artifact* all_artis, int upgrade_ratio[SLOT_CT][2]) {
+  const ScoreTable table(farming_config);
   for (int i = 0; i < n; i++) {
     gen_random(all_artis + i, farming_config);
-    max_set.upgrade_ratio[all_artis[i].slot][1]++;
+    upgrade_ratio[all_artis[i].slot][1]++;
     // Only upgrade if satisfying basic quality constraints
-    if (farming_config.upgradeable(all_artis[i])) {
+    if (table.score(all_artis[i]) >= farming_config.min_stat_score[all_artis[i].slot]) {
       upgrade_full(all_artis + i);
-      max_set.upgrade_ratio[all_artis[i].slot][0]++;
+      upgrade_ratio[all_artis[i].slot][0]++;
     }
-    all_artis[i].stat_score = farming_config.score(all_artis[i]);
+    all_artis[i].stat_score = table.score(all_artis[i]);
   }
-  // Sort from greatest to least score, so that the best set is found as quickly as possible
-  std::sort(all_artis, all_artis+n, [](Artifact& a, Artifact& b) {
-    return a.stat_score > b.stat_score;
-  });
+}
+
+// Same as above, but only keeps the candidates for the optimizer: the leveled pieces without a useless
+// mainstat go straight into by_slot in the order generated, and the others are dropped.
+void farm_candidate_artifacts(FarmingConfig& farming_config, int n, std::vector<Artifact>* by_slot,
+                              int upgrade_ratio[SLOT_CT][2]) {
+  const ScoreTable table(farming_config);
+  for (int i = 0; i < SLOT_CT; i++)
+    by_slot[i].clear();
+  for (int i = 0; i < n; i++) {
+    Artifact a;
+    gen_random(&a, farming_config);
+    upgrade_ratio[a.slot][1]++;
+    if (table.score(a) < farming_config.min_stat_score[a.slot]) continue;
+    upgrade_full(&a);
+    upgrade_ratio[a.slot][0]++;
+    if (a.slot >= SANDS && farming_config.stat_score[a.mainstat] == 0) continue;
+    a.stat_score = table.score(a);
+    by_slot[a.slot].push_back(a);
+  }
+}
 
+// Returns whether pieces of the slot can have the mainstat.
+bool possible_mainstat(int slot, int stat) {
+  return MAINSTAT_WEIGHT[slot][stat] > (stat > 0 ? MAINSTAT_WEIGHT[slot][stat-1] : 0);
+}
+
+// The amount of a stat that one point of its stat_score weight stands for: its smallest substat roll.
+// Stats that are only mainstats use the same fraction of their mainstat as an ATK% roll is of an
+// ATK% mainstat, so that mainstat scores compare the same way for every stat.
+int score_unit(int stat) {
+  if (stat < SUBSTAT_CT) return SUBSTAT_LEVEL[stat][0];
+  return std::max(1, MAINSTAT_LEVEL[stat] * SUBSTAT_LEVEL[ATKP][0] / MAINSTAT_LEVEL[ATKP]);
+}
+
+// Sorts the pieces of every slot from greatest to least score, so that the best set is found as quickly
+// as possible. Pieces with the same score keep their order.
+void sort_slots(std::vector<Artifact>* by_slot) {
+  for (int i = 0; i < SLOT_CT; i++) {
+    std::stable_sort(by_slot[i].begin(), by_slot[i].end(), [](const Artifact& a, const Artifact& b) {
+      return a.stat_score > b.stat_score;
+    });
+  }
+}
+
+// Puts the +20 pieces of all_artis without a useless mainstat into by_slot, sorted by sort_slots.
+void sort_candidates(const FarmingConfig& farming_config, const Artifact* all_artis, int n, std::vector<Artifact>* by_slot) {
   // Step 2: Categorize artifacts by slot
-  int size[SLOT_CT] = {0, 0, 0, 0, 0};
-  Artifact* by_slot[SLOT_CT];
   for (int i = 0; i < SLOT_CT; i++)
-    by_slot[i] = new Artifact[n];
+    by_slot[i].clear();
   for (int i = 0; i < n; i++) {
     // Do not use artifacts that aren't +20
     if (all_artis[i].level < 20) continue;
     // Do not use pieces with a useless mainstat
     if (all_artis[i].slot >= SANDS && farming_config.stat_score[all_artis[i].mainstat] == 0) continue;
-    by_slot[all_artis[i].slot][size[all_artis[i].slot]] = all_artis[i];
-    size[all_artis[i].slot]++;
+    by_slot[all_artis[i].slot].push_back(all_artis[i]);
+  }
+  sort_slots(by_slot);
+}
+
+// The search of optimize_set, on candidates sorted into slots by sort_candidates.
+void search_candidates(Character& character, Weapon& weapon, std::vector<Artifact>* candidates, FarmedSet* result,
+                       int k, std::vector<FarmedSet>* top_sets) {
+  FarmingConfig& farming_config = character.farming_config;
+  int size[SLOT_CT];
+  Artifact* by_slot[SLOT_CT];
+  for (int i = 0; i < SLOT_CT; i++) {
+    by_slot[i] = candidates[i].data();
+    size[i] = (int) candidates[i].size();
   }
 
+  // Large inventories take too long to search piece by piece. The meet in the middle search only finds the
+  // best set. Approximate searches seed it with a local search, and let it skip sets within the gap.
+  const bool approximate = optimizer_gap > 0 || optimizer_max_sets > 0;
+  if (k == 1 && (approximate || uses_meet_in_the_middle(size))) {
+    if (approximate) local_search(character, weapon, by_slot, size, result);
+    meet_in_the_middle(character, weapon, by_slot, size, optimizer_gap, optimizer_max_sets, result);
+    if (!approximate) result->damage_bound = result->damage;
+    if (top_sets != nullptr) {
+      top_sets->clear();
+      if (result->damage > 0) top_sets->push_back(*result);
+    }
+    return;
+  }
+
+  // Partial sets that can't satisfy the stat constraints any more are pruned at every slot.
+  // This only skips infeasible sets, so the first complete set reached is always feasible.
+  const std::vector<ConstraintBound> bounds = constraint_bounds(character, weapon, by_slot, size);
+
   // Step 3: Brute force the set that gives the most damage by checking all possibilities
   // Track the total stats gained from artifacts as we go
   int artifact_stats[MAINSTAT_CT];
@@ -114,45 +919,70 @@ FarmedSet farm(Character& character, Weapon& weapon, int n) {
   int set_count[SET_CT];
   for (int i = 0; i < SET_CT; i++)
     set_count[i] = 0;
+  int64_t leaf_sets = 0;
+
+  // The k best sets found so far, as a min heap by damage. Once it is full, a set must beat the
+  // k-th best to get in, and pieces are skipped against the pieces of the k-th best set.
+  std::vector<FarmedSet> heap;
+  heap.reserve(k);
+  auto worse = [](const FarmedSet& x, const FarmedSet& y) { return x.damage > y.damage; };
+  // Damage a set must exceed to enter the heap, and the pruning threshold of each slot
+  int min_damage = 0;
+  int min_score[SLOT_CT] = {0, 0, 0, 0, 0};
 
   for (int a = 0; a < size[FLOWER]; a++) {
     // Roughly check that the piece isn't garbage using # of good sub rolls
-    if (by_slot[FLOWER][a].stat_score <= max_set.artifacts[FLOWER].stat_score - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+    if (by_slot[FLOWER][a].stat_score <= min_score[FLOWER] - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+    if (!feasible(bounds, artifact_stats, by_slot[FLOWER][a])) continue;
     // Incrementally add and subtract each artifact from total stats
     add_artifact_stats(artifact_stats, by_slot[FLOWER][a]);
     set_count[by_slot[FLOWER][a].set]++;
 
     // And repeat for all 5 slots
     for (int b = 0; b < size[FEATHER]; b++) {
-      if (by_slot[FEATHER][b].stat_score <= max_set.artifacts[FEATHER].stat_score - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+      if (by_slot[FEATHER][b].stat_score <= min_score[FEATHER] - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+      if (!feasible(bounds, artifact_stats, by_slot[FEATHER][b])) continue;
       add_artifact_stats(artifact_stats, by_slot[FEATHER][b]);
       set_count[by_slot[FEATHER][b].set]++;
 
       for (int c = 0; c < size[SANDS]; c++) {
-        if (by_slot[SANDS][c].stat_score <= max_set.artifacts[SANDS].stat_score - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+        if (by_slot[SANDS][c].stat_score <= min_score[SANDS] - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+        if (!feasible(bounds, artifact_stats, by_slot[SANDS][c])) continue;
         add_artifact_stats(artifact_stats, by_slot[SANDS][c]);
         set_count[by_slot[SANDS][c].set]++;
 
         for (int d = 0; d < size[GOBLET]; d++) {
-          if (by_slot[GOBLET][d].stat_score <= max_set.artifacts[GOBLET].stat_score - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+          if (by_slot[GOBLET][d].stat_score <= min_score[GOBLET] - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+          if (!feasible(bounds, artifact_stats, by_slot[GOBLET][d])) continue;
           add_artifact_stats(artifact_stats, by_slot[GOBLET][d]);
           set_count[by_slot[GOBLET][d].set]++;
 
           for (int e = 0; e < size[CIRCLET]; e++) {
-            if (by_slot[CIRCLET][e].stat_score <= max_set.artifacts[CIRCLET].stat_score - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+            if (by_slot[CIRCLET][e].stat_score <= min_score[CIRCLET] - farming_config.stat_score_max * GOOD_ROLLS_MARGIN) continue;
+            if (!feasible(bounds, artifact_stats, by_slot[CIRCLET][e])) continue;
             add_artifact_stats(artifact_stats, by_slot[CIRCLET][e]);
             set_count[by_slot[CIRCLET][e].set]++;
 
-            // Check for sufficient ER
-            if (artifact_stats[ER] + character.stats[ER] + weapon.stats[ER] >= farming_config.required_er) {
-              int curr_damage = calc_damage(character, weapon, artifact_stats, set_count);
-              if (curr_damage > max_set.damage) {
-                max_set.damage = curr_damage;
-                max_set.artifacts[FLOWER] = by_slot[FLOWER][a];
-                max_set.artifacts[FEATHER] = by_slot[FEATHER][b];
-                max_set.artifacts[SANDS] = by_slot[SANDS][c];
-                max_set.artifacts[GOBLET] = by_slot[GOBLET][d];
-                max_set.artifacts[CIRCLET] = by_slot[CIRCLET][e];
+            int curr_damage = calc_damage(character, weapon, artifact_stats, set_count);
+            leaf_sets++;
+            if (curr_damage > min_damage) {
+              if ((int) heap.size() == k) {
+                std::pop_heap(heap.begin(), heap.end(), worse);
+                heap.pop_back();
+              }
+              FarmedSet set;
+              set.damage = curr_damage;
+              set.artifacts[FLOWER] = by_slot[FLOWER][a];
+              set.artifacts[FEATHER] = by_slot[FEATHER][b];
+              set.artifacts[SANDS] = by_slot[SANDS][c];
+              set.artifacts[GOBLET] = by_slot[GOBLET][d];
+              set.artifacts[CIRCLET] = by_slot[CIRCLET][e];
+              heap.push_back(set);
+              std::push_heap(heap.begin(), heap.end(), worse);
+              if ((int) heap.size() == k) {
+                min_damage = heap.front().damage;
+                for (int i = 0; i < SLOT_CT; i++)
+                  min_score[i] = heap.front().artifacts[i].stat_score;
               }
             }
 
@@ -171,10 +1001,387 @@ FarmedSet farm(Character& character, Weapon& weapon, int n) {
     subtract_artifact_stats(artifact_stats, by_slot[FLOWER][a]);
     set_count[by_slot[FLOWER][a].set]--;
   }
+  std::sort_heap(heap.begin(), heap.end(), worse);
+  result->leaf_sets += leaf_sets;
+  if (!heap.empty()) {
+    result->damage = heap[0].damage;
+    result->damage_bound = heap[0].damage;
+    for (int i = 0; i < SLOT_CT; i++)
+      result->artifacts[i] = heap[0].artifacts[i];
+  }
+  if (top_sets != nullptr) {
+    top_sets->clear();
+    for (FarmedSet& set : heap) {
+      std::copy(&result->upgrade_ratio[0][0], &result->upgrade_ratio[0][0] + 2 * SLOT_CT, &set.upgrade_ratio[0][0]);
+      set.leaf_sets = result->leaf_sets;
+      set.damage_bound = set.damage;
+      top_sets->push_back(set);
+    }
+  }
+}
+
+}  // namespace
+
+void derive_stat_weights(Character& character, Weapon& weapon, int* weights) {
+  const FarmingConfig& fcfg = character.farming_config;
+
+  // Build the representative set: average substats, the target set bonuses, and in each slot the
+  // mainstat adding the most damage
+  int artifact_stats[MAINSTAT_CT];
+  for (int i = 0; i < MAINSTAT_CT; i++) {
+    artifact_stats[i] = 0;
+    if (i < SUBSTAT_CT) {
+      const int* level = SUBSTAT_LEVEL[i];
+      artifact_stats[i] = REPRESENTATIVE_ROLLS * (level[0] + level[1] + level[2] + level[3]) / 4;
+    }
+  }
+  int set_count[SET_CT];
+  for (int i = 0; i < SET_CT; i++)
+    set_count[i] = 0;
+  int two_pc_sets = 0;
+  for (int i = 0; i < SET_CT; i++) {
+    if (fcfg.target_sets[i][FOUR_PC]) {
+      for (int j = 0; j < SET_CT; j++)
+        set_count[j] = 0;
+      set_count[i] = 4;
+      break;
+    }
+    if (fcfg.target_sets[i][TWO_PC] && two_pc_sets < 2) {
+      set_count[i] = 2;
+      two_pc_sets++;
+    }
+  }
+  for (int slot = 0; slot < SLOT_CT; slot++) {
+    int best_stat = -1, best_damage = 0;
+    for (int stat = 0; stat < MAINSTAT_CT; stat++) {
+      if (!possible_mainstat(slot, stat)) continue;
+      artifact_stats[stat] += MAINSTAT_LEVEL[stat];
+      const int damage = calc_damage(character, weapon, artifact_stats, set_count);
+      artifact_stats[stat] -= MAINSTAT_LEVEL[stat];
+      if (best_stat < 0 || damage > best_damage) {
+        best_stat = stat;
+        best_damage = damage;
+      }
+    }
+    artifact_stats[best_stat] += MAINSTAT_LEVEL[best_stat];
+  }
+
+  // Central difference of the damage over one unit of each stat
+  int64_t gradient[MAINSTAT_CT];
+  int64_t max_gradient = 0;
+  for (int stat = 0; stat < MAINSTAT_CT; stat++) {
+    const int unit = score_unit(stat);
+    artifact_stats[stat] += unit;
+    const int up = calc_damage(character, weapon, artifact_stats, set_count);
+    artifact_stats[stat] -= 2 * unit;
+    const int down = calc_damage(character, weapon, artifact_stats, set_count);
+    artifact_stats[stat] += unit;
+    gradient[stat] = up - down;
+    max_gradient = std::max(max_gradient, gradient[stat]);
+  }
+
+  for (int stat = 0; stat < MAINSTAT_CT; stat++) {
+    weights[stat] = fcfg.stat_score[stat];
+    // Damage doesn't see what a stat minimum is for, so those stats keep their configured weight
+    bool has_min = false;
+    for (const StatConstraint& constraint : fcfg.constraints)
+      has_min |= (constraint.stat == stat && constraint.min != std::numeric_limits<int>::min());
+    if (has_min || max_gradient <= 0) continue;
+    const int64_t scaled = 2 * fcfg.stat_score_max * std::max<int64_t>(0, gradient[stat]);
+    weights[stat] = (int) ((scaled + max_gradient) / (2 * max_gradient));
+  }
+}
+
+void apply_derived_stat_weights(Character& character, Weapon& weapon) {
+  FarmingConfig& fcfg = character.farming_config;
+  int weights[MAINSTAT_CT];
+  derive_stat_weights(character, weapon, weights);
+  fcfg.stat_score_max = 0;
+  for (int i = 0; i < MAINSTAT_CT; i++) {
+    fcfg.stat_score[i] = weights[i];
+    fcfg.stat_score_max = std::max(fcfg.stat_score_max, weights[i]);
+  }
+}
+
+WeightComparison compare_search_weights(Character& baseline, Character& candidate, Weapon& weapon,
+                                        int iters, int n, uint64_t master_seed) {
+  WeightComparison comparison = {};
+  for (int iter = 0; iter < iters; iter++) {
+    FarmedSet sets[2];
+    Artifact* baseline_artis = get_artifact_storage(n);
+    Artifact* candidate_artis = get_artifact_storage(n);
+    seed(iteration_seed(master_seed, iter));
+    baseline.farming_config.domain_idx = 0;
+    farm_artifacts(baseline.farming_config, n, baseline_artis, sets[0].upgrade_ratio);
+    for (int i = 0; i < n; i++) {
+      candidate_artis[i] = baseline_artis[i];
+      candidate_artis[i].stat_score = candidate.farming_config.score(candidate_artis[i]);
+    }
+
+    optimize_set(baseline, weapon, baseline_artis, n, &sets[0]);
+    optimize_set(candidate, weapon, candidate_artis, n, &sets[1]);
+    for (int i = 0; i < 2; i++) {
+      comparison.leaf_sets[i] += sets[i].leaf_sets;
+      comparison.damage_total[i] += sets[i].damage;
+    }
+    if (sets[1].damage < sets[0].damage) comparison.lower_damage++;
+    if (sets[1].damage > sets[0].damage) comparison.higher_damage++;
+    delete[] baseline_artis;
+    delete[] candidate_artis;
+  }
+  return comparison;
+}
+
+FarmedSet farm(Character& character, Weapon& weapon, int n) {
+  return farm(character, weapon, n, 1, nullptr);
+}
+
+FarmedSet farm(Character& character, Weapon& weapon, int n, int k, std::vector<FarmedSet>* top_sets) {
+  FarmingConfig& farming_config = character.farming_config;
+  FarmedSet max_set;
+
+  // Step 1: Generate n artifacts
+  Artifact* all_artis = get_artifact_storage(n);
+  take_likelihood_ratio();
+  farm_artifacts(farming_config, n, all_artis, max_set.upgrade_ratio);
+  max_set.weight = take_likelihood_ratio();
+
+  optimize_set(character, weapon, all_artis, n, &max_set, k, top_sets);
 
-  for (int i = 0; i < SLOT_CT; i++)
-    delete[] by_slot[i];
   delete[] all_artis;
 
   return max_set;
 }
+
+FarmedSet farm(Character& character, Weapon& weapon, int n, uint64_t master_seed, int iter) {
+  return farm(character, weapon, n, master_seed, iter, GENERATOR_SCALAR);
+}
+
+FarmedSet farm(Character& character, Weapon& weapon, int n, uint64_t master_seed, int iter, Generator generator) {
+  FarmWorkspace workspace;
+  farm_candidates(character, n, master_seed, iter, generator, &workspace);
+  return optimize_candidates(character, weapon, workspace);
+}
+
+void farm_candidates(Character& character, int n, uint64_t master_seed, int iter, Generator generator,
+                     FarmWorkspace* workspace) {
+  FarmingConfig& farming_config = character.farming_config;
+  workspace->iter = iter;
+  workspace->weight = 1.0;
+  std::fill(&workspace->upgrade_ratio[0][0], &workspace->upgrade_ratio[0][0] + 2 * SLOT_CT, 0);
+
+  // Step 1: Generate n artifacts one at a time, keeping only the candidates
+  if (generator == GENERATOR_SCALAR) {
+    seed(iteration_seed(master_seed, iter));
+    farming_config.domain_idx = 0;
+    take_likelihood_ratio();
+    farm_candidate_artifacts(farming_config, n, workspace->by_slot, workspace->upgrade_ratio);
+    workspace->weight = take_likelihood_ratio();
+    sort_slots(workspace->by_slot);
+    return;
+  }
+
+  // Or generate them in one batch, leveling only the ones that pass min_stat_score, or only draw
+  // the candidates among them
+  std::vector<Artifact>& drops = workspace->drops;
+  drops.resize(n);
+  const int size = (generator == GENERATOR_CANDIDATES)
+      ? gen_candidate_batch(farming_config, n, iteration_seed(master_seed, iter), drops.data(),
+                            workspace->upgrade_ratio)
+      : gen_upgraded_batch(farming_config, n, iteration_seed(master_seed, iter), drops.data(),
+                           workspace->upgrade_ratio);
+
+  sort_candidates(farming_config, drops.data(), size, workspace->by_slot);
+}
+
+FarmedSet optimize_candidates(Character& character, Weapon& weapon, FarmWorkspace& workspace) {
+  FarmedSet max_set;
+  std::copy(&workspace.upgrade_ratio[0][0], &workspace.upgrade_ratio[0][0] + 2 * SLOT_CT, &max_set.upgrade_ratio[0][0]);
+  max_set.weight = workspace.weight;
+  search_candidates(character, weapon, workspace.by_slot, &max_set, 1, nullptr);
+  return max_set;
+}
+
+FarmedSet farm_to(Character& character, Weapon& weapon, int target, int max_n, uint64_t master_seed, int iter,
+                  int* artifacts_farmed) {
+  FarmingConfig& farming_config = character.farming_config;
+  seed(iteration_seed(master_seed, iter));
+  farming_config.domain_idx = 0;
+
+  FarmedSet max_set;
+  std::vector<Artifact> by_slot[SLOT_CT];
+  int n = 0;
+  while (n < max_n && (max_set.damage < target || max_set.damage == 0)) {
+    Artifact a;
+    gen_random(&a, farming_config);
+    n++;
+    max_set.upgrade_ratio[a.slot][1]++;
+    // Only upgrade if satisfying basic quality constraints
+    if (!farming_config.upgradeable(a)) continue;
+    upgrade_full(&a);
+    max_set.upgrade_ratio[a.slot][0]++;
+    // Do not use pieces with a useless mainstat
+    if (a.slot >= SANDS && farming_config.stat_score[a.mainstat] == 0) continue;
+    a.stat_score = farming_config.score(a);
+    add_to_best_set(character, weapon, a, by_slot, &max_set);
+  }
+  *artifacts_farmed = n;
+  return max_set;
+}
+
+FarmedSet farm(Character& character, Weapon& weapon, int n, const DropCache& cache, int iter) {
+  FarmWorkspace workspace;
+  farm_candidates(character, n, cache, iter, &workspace);
+  return optimize_candidates(character, weapon, workspace);
+}
+
+FarmedSet farm(Character& character, Weapon& weapon, int n, const DropCache& cache, int iter,
+               int k, std::vector<FarmedSet>* top_sets) {
+  FarmWorkspace workspace;
+  farm_candidates(character, n, cache, iter, &workspace);
+  FarmedSet max_set;
+  std::copy(&workspace.upgrade_ratio[0][0], &workspace.upgrade_ratio[0][0] + 2 * SLOT_CT, &max_set.upgrade_ratio[0][0]);
+  search_candidates(character, weapon, workspace.by_slot, &max_set, k, top_sets);
+  return max_set;
+}
+
+void farm_candidates(Character& character, int n, const DropCache& cache, int iter, FarmWorkspace* workspace) {
+  FarmingConfig& farming_config = character.farming_config;
+  workspace->iter = iter;
+  workspace->weight = 1.0;
+  std::fill(&workspace->upgrade_ratio[0][0], &workspace->upgrade_ratio[0][0] + 2 * SLOT_CT, 0);
+
+  // Find where this iteration starts reading in each domain stream
+  int64_t position[DOMAIN_CT];
+  drops_per_iteration(farming_config.domains, n, position);
+  for (int i = 0; i < DOMAIN_CT; i++)
+    position[i] *= iter;
+
+  // Step 1: Read n artifacts from the round robin of domains. Only copy the ones that get upgraded.
+  std::vector<Artifact>& candidates = workspace->drops;
+  candidates.resize(n);
+  int size = 0;
+  for (int i = 0; i < n; i++) {
+    const Domain domain = farming_config.domains[i % farming_config.domains.size()];
+    const Artifact* drop = cache.streams[domain].drops + 2 * position[domain];
+    position[domain]++;
+
+    workspace->upgrade_ratio[drop->slot][1]++;
+    // Only upgrade if satisfying basic quality constraints
+    if (!farming_config.upgradeable(*drop)) continue;
+    workspace->upgrade_ratio[drop->slot][0]++;
+    candidates[size] = drop[1];
+    candidates[size].stat_score = farming_config.score(candidates[size]);
+    size++;
+  }
+
+  sort_candidates(farming_config, candidates.data(), size, workspace->by_slot);
+}
+
+FarmedSet farm(Character& character, Weapon& weapon, int n, const BootstrapPool& pool, int iter) {
+  FarmWorkspace workspace;
+  farm_candidates(character, n, pool, iter, &workspace);
+  return optimize_candidates(character, weapon, workspace);
+}
+
+void farm_candidates(Character& character, int n, const BootstrapPool& pool, int iter, FarmWorkspace* workspace) {
+  const BootstrapSettings& settings = pool.settings;
+  const int replicate = iter % settings.replicates;
+  const uint8_t* drops = pool.drops.data() + replicate * settings.drops;
+  const int32_t* candidate_idx = pool.candidate_idx.data() + replicate * settings.drops;
+  const std::vector<Artifact>& pool_candidates = pool.candidates[replicate];
+  std::mt19937_64 rng(iteration_seed(pool.master_seed, iter));
+  std::uniform_int_distribution<int64_t> drop_dist(0, settings.drops - 1);
+  workspace->iter = iter;
+  workspace->weight = 1.0;
+  std::fill(&workspace->upgrade_ratio[0][0], &workspace->upgrade_ratio[0][0] + 2 * SLOT_CT, 0);
+
+  // Step 1: Draw n drops from the replicate. Only copy the ones that get upgraded.
+  std::vector<Artifact>& candidates = workspace->drops;
+  candidates.resize(n);
+  int size = 0;
+  // Windows start at a random drop and wrap around the end of the replicate
+  int64_t drop = drop_dist(rng);
+  for (int i = 0; i < n; i++) {
+    if (i > 0) drop = settings.windows ? ((drop + 1 == settings.drops) ? 0 : drop + 1) : drop_dist(rng);
+    workspace->upgrade_ratio[drops[drop] & ~BOOTSTRAP_LEVELED][1]++;
+    if (drops[drop] & BOOTSTRAP_LEVELED) workspace->upgrade_ratio[drops[drop] & ~BOOTSTRAP_LEVELED][0]++;
+    if (candidate_idx[drop] >= 0) candidates[size++] = pool_candidates[candidate_idx[drop]];
+  }
+
+  sort_candidates(character.farming_config, candidates.data(), size, workspace->by_slot);
+}
+
+bool uses_meet_in_the_middle(const int* size) {
+  for (int i = 0; i < SLOT_CT; i++) {
+    if (size[i] == 0) return false;
+  }
+  // Stop once the threshold is reached, so that the product of large slots can't overflow
+  int64_t sets = 1;
+  for (int i = 0; i < SLOT_CT && sets < MEET_IN_THE_MIDDLE_MIN_SETS; i++)
+    sets *= size[i];
+  return sets >= MEET_IN_THE_MIDDLE_MIN_SETS;
+}
+
+void set_search_threads(int threads) {
+  search_threads = threads;
+}
+
+void set_optimizer_gap(double gap, int64_t max_sets) {
+  optimizer_gap = gap;
+  optimizer_max_sets = max_sets;
+}
+
+void optimize_set(Character& character, Weapon& weapon, Artifact* all_artis, int n, FarmedSet* result) {
+  optimize_set(character, weapon, all_artis, n, result, 1, nullptr);
+}
+
+void reference_optimize_set(Character& character, Weapon& weapon, const Artifact* all_artis, int n, FarmedSet* result) {
+  const FarmingConfig& farming_config = character.farming_config;
+  // Same candidates as optimize_set: +20 pieces without a useless mainstat
+  std::vector<Artifact> by_slot[SLOT_CT];
+  for (int i = 0; i < n; i++) {
+    const Artifact& a = all_artis[i];
+    if (a.level < 20) continue;
+    if (a.slot >= SANDS && farming_config.stat_score[a.mainstat] == 0) continue;
+    by_slot[a.slot].push_back(a);
+  }
+  Artifact* slot_pieces[SLOT_CT];
+  int size[SLOT_CT];
+  for (int i = 0; i < SLOT_CT; i++) {
+    slot_pieces[i] = by_slot[i].data();
+    size[i] = (int) by_slot[i].size();
+  }
+
+  SetSearch search = {character, weapon, slot_pieces, size, constraint_bounds(character, weapon, slot_pieces, size),
+                      false, {}, {}, {}, result};
+  search_sets(search, 0);
+}
+
+int set_damage(Character& character, Weapon& weapon, const Artifact* set) {
+  int artifact_stats[MAINSTAT_CT] = {};
+  int set_count[SET_CT] = {};
+  for (int i = 0; i < SLOT_CT; i++) {
+    Artifact a = set[i];
+    add_artifact_stats(artifact_stats, a);
+    set_count[a.set]++;
+  }
+  return calc_damage(character, weapon, artifact_stats, set_count);
+}
+
+bool satisfies_constraints(Character& character, Weapon& weapon, const Artifact* set) {
+  for (const StatConstraint& constraint : character.farming_config.constraints) {
+    int64_t total = character.stats[constraint.stat] + weapon.stats[constraint.stat];
+    for (int i = 0; i < SLOT_CT; i++)
+      total += artifact_stat(set[i], constraint.stat);
+    if (total < constraint.min || total > constraint.max) return false;
+  }
+  return true;
+}
+
+void optimize_set(Character& character, Weapon& weapon, Artifact* all_artis, int n, FarmedSet* result,
+                  int k, std::vector<FarmedSet>* top_sets) {
+  std::vector<Artifact> by_slot[SLOT_CT];
+  sort_candidates(character.farming_config, all_artis, n, by_slot);
+  search_candidates(character, weapon, by_slot, result, k, top_sets);
+}
@@ -1,14 +1,26 @@
 #ifndef __FARM_H__
 #define __FARM_H__
 
+#include <cstdint>
+#include <vector>
+
+#include "bootstrap.h"
+#include "drop_cache.h"
 #include "types.h"
 
 struct FarmedSet {
   Artifact artifacts[SLOT_CT];
   int damage;
+  // Upper bound on the damage of the best set, certified by the approximate optimizer (see
+  // set_optimizer_gap). Equal to damage for the other searches of optimize_set.
+  int damage_bound;
   int upgrade_ratio[SLOT_CT][2];
+  // Number of complete sets whose damage the optimizer calculated
+  int64_t leaf_sets;
+  // Likelihood ratio of the farmed artifacts when generated with a crit tilt (see set_crit_tilt), 1 otherwise
+  double weight;
 
-  FarmedSet() : damage(0) {
+  FarmedSet() : damage(0), damage_bound(0), leaf_sets(0), weight(1.0) {
     for (int i = 0; i < SLOT_CT; i++) {
       upgrade_ratio[i][0] = 0;
       upgrade_ratio[i][1] = 0;
@@ -19,8 +31,127 @@ struct FarmedSet {
   ~FarmedSet() = default;
 };
 
+// How seeded iterations generate artifacts. The generators follow the same distribution,
+// but give different artifacts for the same seed.
+enum Generator {
+  GENERATOR_SCALAR = 0,
+  // Batch generator from gen_batch.h
+  GENERATOR_BATCH,
+  // Candidate generator from gen_batch.h, drawing only the pieces that reach the optimizer
+  GENERATOR_CANDIDATES
+};
+
 // Farm n artifacts for given character and weapon and return the damage modifier achieved.
 // If no offensive mainstat is achieved for any slot, the optimizer will return 0 damage.
 FarmedSet farm(Character& character, Weapon& weapon, int n);
+// Same as above, but also stores the k sets with the most damage in top_sets, best first.
+FarmedSet farm(Character& character, Weapon& weapon, int n, int k, std::vector<FarmedSet>* top_sets);
+// Same as above, but farms with the random substream for iteration iter of a run seeded with master_seed,
+// starting from the first domain. Results only depend on the configs, n, master_seed, and iter.
+FarmedSet farm(Character& character, Weapon& weapon, int n, uint64_t master_seed, int iter);
+// Same as above, using the given generator.
+FarmedSet farm(Character& character, Weapon& weapon, int n, uint64_t master_seed, int iter, Generator generator);
+// Farm artifacts with the random substream of farm(character, weapon, n, master_seed, iter) until the best
+// set reaches target damage, or max_n artifacts are farmed. The best set is updated as each piece is leveled,
+// evaluating only the sets containing the new piece, and the number of artifacts farmed is stored in
+// artifacts_farmed. Uses the same pruning as the nested loops of optimize_set.
+FarmedSet farm_to(Character& character, Weapon& weapon, int target, int max_n, uint64_t master_seed, int iter,
+                  int* artifacts_farmed);
+// Same as above, but takes the drops from the cache instead of generating them. Iteration iter reads
+// the iter-th block of drops from each domain stream, so no two iterations share drops.
+// The cache must be opened with enough drops for iter+1 iterations.
+FarmedSet farm(Character& character, Weapon& weapon, int n, const DropCache& cache, int iter);
+FarmedSet farm(Character& character, Weapon& weapon, int n, const DropCache& cache, int iter,
+               int k, std::vector<FarmedSet>* top_sets);
+// Same as above, but takes the drops from replicate iter % replicates of the bootstrap pool, drawing
+// them with the random substream iter of the pool's master seed. n must not exceed the drops of a
+// replicate when taking windows.
+FarmedSet farm(Character& character, Weapon& weapon, int n, const BootstrapPool& pool, int iter);
+
+// The candidates of one farm iteration, sorted into slots for the optimizer, and what the iteration
+// records besides its best set. Reusing a workspace for later iterations keeps its buffers allocated.
+struct FarmWorkspace {
+  int iter;
+  // The iteration's drops that can reach the optimizer, scored, and leveled if they pass min_stat_score.
+  // Unused by the scalar generator, which puts the candidates straight into by_slot.
+  std::vector<Artifact> drops;
+  // The +20 pieces without a useless mainstat, from highest to lowest stat score, equal scores in the
+  // order they dropped
+  std::vector<Artifact> by_slot[SLOT_CT];
+  int upgrade_ratio[SLOT_CT][2];
+  double weight;
+};
+
+// The first stage of the farm overloads above for k = 1: farm the drops of iteration iter the same way,
+// and sort the candidates into the workspace. Optimizing them with optimize_candidates gives the same set.
+void farm_candidates(Character& character, int n, uint64_t master_seed, int iter, Generator generator,
+                     FarmWorkspace* workspace);
+void farm_candidates(Character& character, int n, const DropCache& cache, int iter, FarmWorkspace* workspace);
+void farm_candidates(Character& character, int n, const BootstrapPool& pool, int iter, FarmWorkspace* workspace);
+// The second stage: find the best set of the workspace's candidates like optimize_set.
+FarmedSet optimize_candidates(Character& character, Weapon& weapon, FarmWorkspace& workspace);
+
+// Totals over the iterations of compare_search_weights, for the baseline [0] and candidate [1] weights.
+struct WeightComparison {
+  int64_t leaf_sets[2];
+  int64_t damage_total[2];
+  // Iterations where the candidate weights found a set with less or more damage than the baseline.
+  // Weights only change which sets the optimizer skips, so these come from GOOD_ROLLS_MARGIN pruning.
+  int lower_damage;
+  int higher_damage;
+};
+
+// Derive stat_score weights for the character and weapon from the change in damage that one unit of
+// each stat (a low substat roll) adds to a typical +20 set: average substats, the mainstats giving
+// the most damage, and the target set bonuses. The weights are scaled so that the most valuable stat
+// is worth stat_score_max. Stats with a minimum constraint keep their configured weight.
+void derive_stat_weights(Character& character, Weapon& weapon, int* weights);
+// Replace the character's stat_score weights and stat_score_max with derived ones.
+void apply_derived_stat_weights(Character& character, Weapon& weapon);
+// Farm iters seeded runs of n artifacts with the baseline's farming config, and optimize each one
+// with the baseline's and the candidate's stat weights, to compare how many sets the search evaluates.
+WeightComparison compare_search_weights(Character& baseline, Character& candidate, Weapon& weapon,
+                                        int iters, int n, uint64_t master_seed);
+
+// optimize_set switches from the nested loops to the exact meet in the middle search once the candidates
+// make at least this many sets, where the nested loops get slow even with GOOD_ROLLS_MARGIN pruning.
+// The number of sets rather than the largest slot decides, since one large slot among small ones
+// leaves few sets, and few pairs for the meet in the middle search to prune.
+constexpr int64_t MEET_IN_THE_MIDDLE_MIN_SETS = 1000000;
+// Whether optimize_set searches candidates with size[i] pieces in slot i with the meet in the middle
+// search for k = 1, instead of the nested loops.
+bool uses_meet_in_the_middle(const int* size);
+
+// Sets the number of threads the meet in the middle search of optimize_set uses when called from this
+// thread, or one per hardware thread if threads <= 0. The default is 1. The search finds the same set
+// on any number of threads, but may evaluate a different number of sets to find it.
+void set_search_threads(int threads);
+
+// Makes optimize_set approximate when called from this thread with k = 1, if gap > 0 or max_sets > 0.
+// A greedy set, improved by swapping one piece at a time while that adds damage, seeds the meet in the
+// middle search, which then skips any set whose upper bound is within gap of the best set found, so the
+// set found has at least (1 - gap) times the damage of the best set. If max_sets > 0, the search also
+// stops after evaluating about max_sets sets. Either way, damage_bound certifies how far below the best
+// set it may be. The default, gap = 0 and max_sets = 0, is the exact search.
+void set_optimizer_gap(double gap, int64_t max_sets);
+
+// Find the set with the most damage that can be made from the +20 artifacts in all_artis
+// and store it in result. The stat_score of each artifact must already be calculated.
+// Once the candidates make many sets, an exact meet in the middle search replaces
+// the nested loops, whose GOOD_ROLLS_MARGIN pruning can miss the best set.
+void optimize_set(Character& character, Weapon& weapon, Artifact* all_artis, int n, FarmedSet* result);
+// Same as above, but also stores the k distinct sets with the most damage in top_sets (if not null),
+// best first. Pieces are skipped against the k-th best set found so far instead of the best, so
+// larger k searches more sets. The meet in the middle search is only used for k = 1.
+void optimize_set(Character& character, Weapon& weapon, Artifact* all_artis, int n, FarmedSet* result,
+                  int k, std::vector<FarmedSet>* top_sets);
+// Reference for optimize_set: evaluates every set of the same candidates that satisfies the stat
+// constraints, without GOOD_ROLLS_MARGIN or any other pruning, and stores the best one in result.
+// Its leaf_sets are increased by the number of sets evaluated. Only feasible for small inventories.
+void reference_optimize_set(Character& character, Weapon& weapon, const Artifact* all_artis, int n, FarmedSet* result);
+// Returns the damage of the set of one artifact per slot, in slot order.
+int set_damage(Character& character, Weapon& weapon, const Artifact* set);
+// Returns whether the set of one artifact per slot satisfies the character's stat constraints.
+bool satisfies_constraints(Character& character, Weapon& weapon, const Artifact* set);
 
 #endif
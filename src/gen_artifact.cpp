@@ -1,12 +1,16 @@
 #include "gen_artifact.h"
 
 #include <chrono>
+#include <cmath>
 #include <random>
 
 namespace {
 
-// Global random number generator, seeded deterministically by default
-std::default_random_engine rng;
+// Random number generator of each thread, seeded deterministically by default
+thread_local std::default_random_engine rng;
+// Importance sampling tilt toward crit upgrades, and the log likelihood ratio of the tilted rolls so far
+thread_local double crit_tilt = 1.0;
+thread_local double log_likelihood_ratio = 0.0;
 
 // Determine whether a substat already exists and needs to be rerolled
 bool repeated_substat(Artifact* arti, int sub_n, int substat_type) {
@@ -58,7 +62,38 @@ void seed() {
           std::chrono::system_clock::now().time_since_epoch()).count());
 }
 
+void seed(uint64_t value) {
+  rng.seed(value);
+}
+
+uint64_t iteration_seed(uint64_t master_seed, uint64_t iter) {
+  // splitmix64 finalizer, so that nearby iterations get unrelated seeds
+  uint64_t z = master_seed + (iter + 1) * 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+void set_crit_tilt(double tilt) {
+  crit_tilt = tilt;
+}
+
+double take_likelihood_ratio() {
+  const double ratio = std::exp(log_likelihood_ratio);
+  log_likelihood_ratio = 0.0;
+  return ratio;
+}
+
+uint64_t gen_seed() {
+  std::uniform_int_distribution<uint64_t> seed_dist;
+  return seed_dist(rng);
+}
+
 void gen_random(Artifact* arti, FarmingConfig& fcfg) {
+  gen_random(arti, fcfg.next_domain());
+}
+
+void gen_random(Artifact* arti, Domain domain_to_farm) {
   // Roll artifact slot
   std::uniform_int_distribution<int> slot_dist(0, SLOT_CT-1);
   int slot = slot_dist(rng);
@@ -78,7 +113,6 @@ void gen_random(Artifact* arti, FarmingConfig& fcfg) {
 
   // Roll set
   std::uniform_int_distribution<int> set_dist(0, 1);
-  const Domain domain_to_farm = fcfg.next_domain();
   arti->set = DOMAIN_TO_SET[domain_to_farm][set_dist(rng)];
 
   arti->level = 0;
@@ -92,19 +126,36 @@ void gen_random(Artifact* arti, FarmingConfig& fcfg) {
   }
 }
 
-void upgrade_full(Artifact* arti) {
-  // If the artifact currently has 3 substats, roll the 4th
-  if (!arti->extra_substat) {
+void upgrade_once(Artifact* arti) {
+  // An artifact with 3 substats gains its 4th substat at +4, otherwise an existing substat is upgraded
+  if (arti->level == 0 && !arti->extra_substat) {
     roll_substat(arti, 3);
+  } else {
+    std::uniform_int_distribution<int> upgrade_dist(0, 3);
+    int substat_to_upgrade = HP;
+    if (crit_tilt == 1.0 || arti->substat_values[CR] == 0 || arti->substat_values[CD] == 0) {
+      substat_to_upgrade = arti->substats[upgrade_dist(rng)];
+    } else {
+      // Upgrade the crit substats of a double crit piece crit_tilt times as often as the others
+      std::uniform_real_distribution<double> line_dist(0.0, 2 * crit_tilt + 2);
+      double line_roll = line_dist(rng);
+      for (int i = 0; i < 4; i++) {
+        substat_to_upgrade = arti->substats[i];
+        line_roll -= (substat_to_upgrade == CR || substat_to_upgrade == CD) ? crit_tilt : 1.0;
+        if (line_roll < 0) break;
+      }
+      const double tilted_weight = (substat_to_upgrade == CR || substat_to_upgrade == CD) ? crit_tilt : 1.0;
+      log_likelihood_ratio += std::log((2 * crit_tilt + 2) / (4 * tilted_weight));
+    }
+    arti->substat_values[substat_to_upgrade] += SUBSTAT_LEVEL[substat_to_upgrade][upgrade_dist(rng)];
   }
 
+  arti->level += 4;
+}
+
+void upgrade_full(Artifact* arti) {
   // 4 substat upgrades possible, +1 if the artifact had 4 lines at +0
-  int upgrades = 4 + arti->extra_substat;
-  std::uniform_int_distribution<int> upgrade_dist(0, 3);
-  for (int i = 0; i < upgrades; i++) {
-    int substat_to_upgrade = arti->substats[upgrade_dist(rng)];
-    arti->substat_values[substat_to_upgrade] += SUBSTAT_LEVEL[substat_to_upgrade][upgrade_dist(rng)];
+  while (arti->level < 20) {
+    upgrade_once(arti);
   }
-
-  arti->level = 20;
 }
@@ -1,15 +1,36 @@
 #ifndef __GEN_ARTIFACT_H__
 #define __GEN_ARTIFACT_H__
 
+#include <cstdint>
+
 #include "types.h"
 
+// Each thread has its own RNG, so all functions below only affect the calling thread.
+
 // Seed the RNG using current system time.
 void seed();
+// Seed the RNG with a fixed value.
+void seed(uint64_t value);
+// Returns the seed for the independent random substream used by iteration iter of a run.
+uint64_t iteration_seed(uint64_t master_seed, uint64_t iter);
+// Returns a random 64 bit value from the RNG, e.g. to use as a master seed.
+uint64_t gen_seed();
+
+// Importance sampling: upgrade the CR and CD substats of pieces with both of them tilt times as often
+// as their other substats (1 to sample normally). High crit sets then come up far more often, and each
+// one must be weighted by the likelihood ratio of its rolls under the normal and the tilted distribution.
+void set_crit_tilt(double tilt);
+// Returns the likelihood ratio of all artifacts rolled since the last call, and starts a new product.
+double take_likelihood_ratio();
 
 // Fills arti with a randomly generated +0 artifact.
 // Requires arti to be zero-initialized.
 void gen_random(Artifact* arti, FarmingConfig& fcfg);
-// Upgrades arti from +0 to +20
+// Same as above, but for an artifact dropped from the given domain.
+void gen_random(Artifact* arti, Domain domain);
+// Upgrades arti by 4 levels, e.g. from +8 to +12
+void upgrade_once(Artifact* arti);
+// Upgrades arti from its current level to +20
 void upgrade_full(Artifact* arti);
 
 #endif
@@ -0,0 +1,592 @@
+#include "gen_batch.h"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define BATCH_RNG_AVX2 1
+#endif
+
+namespace {
+
+// Number of independent generator lanes, each producing one 32 bit word per step
+constexpr int LANES = 8;
+// Random words used to generate one +0 artifact: slot, mainstat, set and substat tiers,
+// extra substat, and the types of all 4 substats (including the one gained at +4)
+constexpr int WORDS_PER_ARTIFACT = 5;
+
+// 8 lanes of xoshiro128** state, stored by state word so that each word of all lanes
+// fits in one AVX2 register.
+struct BatchRng {
+  alignas(32) uint32_t s[4][LANES];
+};
+
+// Temporary buffers of a thread, reused between batches.
+struct BatchWorkspace {
+  std::vector<uint32_t> words;
+  std::vector<uint8_t> slot, mainstat, set, extra_substat;
+  std::vector<uint8_t> substats[4], tiers[4];
+  std::vector<int> score;
+  std::vector<int> survivors;
+};
+
+thread_local BatchWorkspace workspace;
+
+uint64_t splitmix64(uint64_t* x) {
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+void seed_rng(BatchRng* rng, uint64_t seed) {
+  for (int i = 0; i < 4; i++) {
+    for (int lane = 0; lane < LANES; lane += 2) {
+      const uint64_t z = splitmix64(&seed);
+      rng->s[i][lane] = (uint32_t) z;
+      rng->s[i][lane+1] = (uint32_t) (z >> 32);
+    }
+  }
+}
+
+inline uint32_t rotl(uint32_t x, int k) {
+  return (x << k) | (x >> (32 - k));
+}
+
+// Writes steps * LANES words to out, word i coming from lane i % LANES.
+void fill_scalar(BatchRng* rng, uint32_t* out, int steps) {
+  uint32_t (&s)[4][LANES] = rng->s;
+  for (int step = 0; step < steps; step++) {
+    for (int lane = 0; lane < LANES; lane++) {
+      out[step * LANES + lane] = rotl(s[1][lane] * 5, 7) * 9;
+      const uint32_t t = s[1][lane] << 9;
+      s[2][lane] ^= s[0][lane];
+      s[3][lane] ^= s[1][lane];
+      s[1][lane] ^= s[2][lane];
+      s[0][lane] ^= s[3][lane];
+      s[2][lane] ^= t;
+      s[3][lane] = rotl(s[3][lane], 11);
+    }
+  }
+}
+
+#ifdef BATCH_RNG_AVX2
+__attribute__((target("avx2")))
+inline __m256i rotl_avx2(__m256i x, int k) {
+  return _mm256_or_si256(_mm256_slli_epi32(x, k), _mm256_srli_epi32(x, 32 - k));
+}
+
+// Same as fill_scalar, with all lanes in one register.
+__attribute__((target("avx2")))
+void fill_avx2(BatchRng* rng, uint32_t* out, int steps) {
+  __m256i s0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(rng->s[0]));
+  __m256i s1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(rng->s[1]));
+  __m256i s2 = _mm256_load_si256(reinterpret_cast<const __m256i*>(rng->s[2]));
+  __m256i s3 = _mm256_load_si256(reinterpret_cast<const __m256i*>(rng->s[3]));
+  const __m256i five = _mm256_set1_epi32(5);
+  const __m256i nine = _mm256_set1_epi32(9);
+  for (int step = 0; step < steps; step++) {
+    const __m256i result = _mm256_mullo_epi32(rotl_avx2(_mm256_mullo_epi32(s1, five), 7), nine);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + step * LANES), result);
+    const __m256i t = _mm256_slli_epi32(s1, 9);
+    s2 = _mm256_xor_si256(s2, s0);
+    s3 = _mm256_xor_si256(s3, s1);
+    s1 = _mm256_xor_si256(s1, s2);
+    s0 = _mm256_xor_si256(s0, s3);
+    s2 = _mm256_xor_si256(s2, t);
+    s3 = rotl_avx2(s3, 11);
+  }
+  _mm256_store_si256(reinterpret_cast<__m256i*>(rng->s[0]), s0);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(rng->s[1]), s1);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(rng->s[2]), s2);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(rng->s[3]), s3);
+}
+#endif
+
+// Appends at least count random words to words.
+void fill_words(BatchRng* rng, int count, std::vector<uint32_t>* words) {
+  const int steps = (count + LANES - 1) / LANES;
+  const size_t begin = words->size();
+  words->resize(begin + steps * LANES);
+#ifdef BATCH_RNG_AVX2
+  if (batch_rng_avx2()) {
+    fill_avx2(rng, words->data() + begin, steps);
+    return;
+  }
+#endif
+  fill_scalar(rng, words->data() + begin, steps);
+}
+
+// Maps a random word to [0, range). The bias is below range / 2^32, far below sampling error.
+inline uint32_t bounded(uint32_t word, uint32_t range) {
+  return (uint32_t) (((uint64_t) word * range) >> 32);
+}
+
+// Samples one of a fixed list of outcomes with a single random word (Vose's alias method).
+struct AliasTable {
+  // Chance of keeping entry j instead of taking its alias, scaled to 2^32
+  std::vector<uint32_t> threshold;
+  std::vector<uint16_t> outcome, alias;
+
+  void build(const std::vector<double>& probs, const std::vector<uint16_t>& outcomes) {
+    const int size = probs.size();
+    threshold.assign(size, 0xFFFFFFFFu);
+    outcome = outcomes;
+    alias = outcomes;
+
+    double total = 0;
+    for (double p : probs)
+      total += p;
+    std::vector<double> scaled(size);
+    std::vector<int> small, large;
+    for (int i = 0; i < size; i++) {
+      scaled[i] = probs[i] * size / total;
+      (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+      const int s = small.back(), l = large.back();
+      small.pop_back();
+      threshold[s] = (uint32_t) (scaled[s] * 4294967296.0);
+      alias[s] = outcomes[l];
+      scaled[l] -= 1.0 - scaled[s];
+      if (scaled[l] < 1.0) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+  }
+
+  // The high bits of word * size pick an entry and the low bits decide between it and its alias.
+  // Like bounded(), this is biased by less than size / 2^32.
+  uint16_t sample(uint32_t word) const {
+    const uint64_t x = (uint64_t) word * threshold.size();
+    const uint32_t j = (uint32_t) (x >> 32);
+    return ((uint32_t) x < threshold[j]) ? outcome[j] : alias[j];
+  }
+};
+
+// Alias tables for the random choices of a +0 artifact that have unequal probabilities.
+struct DropTables {
+  AliasTable mainstat[SLOT_CT];
+  // By mainstat, the substats as 4 bit fields: the first 3 lines in increasing order, then the
+  // line gained at +4 (or present at +0 with an extra substat). Drawing lines one at a time and
+  // rerolling repeats gives the same distribution, and the order of the first 3 lines doesn't matter.
+  AliasTable substats[MAINSTAT_CT];
+  // The outcomes of the substat tables and their chances
+  std::vector<uint16_t> substat_lines[MAINSTAT_CT];
+  std::vector<double> substat_probs[MAINSTAT_CT];
+
+  DropTables() {
+    for (int slot = 0; slot < SLOT_CT; slot++) {
+      std::vector<double> probs;
+      std::vector<uint16_t> outcomes;
+      for (int i = 0; i < MAINSTAT_CT; i++) {
+        const int weight = MAINSTAT_WEIGHT[slot][i] - (i > 0 ? MAINSTAT_WEIGHT[slot][i-1] : 0);
+        if (weight == 0) continue;
+        probs.push_back(weight);
+        outcomes.push_back(i);
+      }
+      mainstat[slot].build(probs, outcomes);
+    }
+
+    for (int m = 0; m < MAINSTAT_CT; m++) {
+      const int total = SUBSTAT_WEIGHT_TOTAL - ((m < SUBSTAT_CT) ? SUBSTAT_WEIGHT[m] : 0);
+      std::vector<double> probs;
+      std::vector<uint16_t> outcomes;
+      for (int a = 0; a < SUBSTAT_CT; a++) {
+        for (int b = a + 1; b < SUBSTAT_CT; b++) {
+          for (int c = b + 1; c < SUBSTAT_CT; c++) {
+            if (a == m || b == m || c == m) continue;
+            // Chance of drawing a, b, c in any order
+            const int lines[3] = {a, b, c};
+            const int orders[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+            double p_triple = 0;
+            for (const auto& order : orders) {
+              double p = 1;
+              int left = total;
+              for (int k = 0; k < 3; k++) {
+                p *= double(SUBSTAT_WEIGHT[lines[order[k]]]) / left;
+                left -= SUBSTAT_WEIGHT[lines[order[k]]];
+              }
+              p_triple += p;
+            }
+            const int left = total - SUBSTAT_WEIGHT[a] - SUBSTAT_WEIGHT[b] - SUBSTAT_WEIGHT[c];
+            for (int d = 0; d < SUBSTAT_CT; d++) {
+              if (d == m || d == a || d == b || d == c) continue;
+              probs.push_back(p_triple * SUBSTAT_WEIGHT[d] / left);
+              outcomes.push_back(a | (b << 4) | (c << 8) | (d << 12));
+            }
+          }
+        }
+      }
+      substats[m].build(probs, outcomes);
+      substat_lines[m] = outcomes;
+      substat_probs[m] = probs;
+    }
+  }
+};
+
+const DropTables& drop_tables() {
+  static const DropTables tables;
+  return tables;
+}
+
+// Per config lookup tables for the stat score of a +0 artifact
+struct ScoreTables {
+  int mainstat[MAINSTAT_CT];
+  int set[SET_CT];
+  // Score of a substat line by type and roll tier
+  int line[SUBSTAT_CT][4];
+};
+
+void build_score_tables(const FarmingConfig& fcfg, ScoreTables* tables) {
+  for (int i = 0; i < MAINSTAT_CT; i++)
+    tables->mainstat[i] = fcfg.mainstat_multiplier * fcfg.stat_score[i];
+  for (int i = 0; i < SET_CT; i++)
+    tables->set[i] = (fcfg.target_sets[i][TWO_PC] || fcfg.target_sets[i][FOUR_PC]) ? fcfg.set_bonus_value : 0;
+  // Same integer estimate of the number of good rolls as FarmingConfig::score
+  for (int i = 0; i < SUBSTAT_CT; i++) {
+    for (int tier = 0; tier < 4; tier++)
+      tables->line[i][tier] = fcfg.stat_score[i] * SUBSTAT_LEVEL[i][tier] / SUBSTAT_LEVEL[i][0];
+  }
+}
+
+// Levels a +0 artifact with all 4 lines set to +20, using the 4 bit choices (line and roll tier)
+// of up to 5 upgrades packed in choices.
+void level_to_20(Artifact* a, uint32_t choices) {
+  // Without an extra substat, the 4th line is gained by the first upgrade
+  const int upgrades = a->extra_substat ? 5 : 4;
+  for (int j = 0; j < upgrades; j++, choices >>= 4) {
+    const int substat = a->substats[choices & 3];
+    a->substat_values[substat] += SUBSTAT_LEVEL[substat][(choices >> 2) & 3];
+  }
+  a->level = 20;
+}
+
+// The words of a BatchRng stream one at a time, as a random bit generator for the standard distributions.
+class WordStream {
+ public:
+  typedef uint32_t result_type;
+
+  explicit WordStream(uint64_t seed) : next(LANES) { seed_rng(&rng, seed); }
+  static constexpr uint32_t min() { return 0; }
+  static constexpr uint32_t max() { return 0xFFFFFFFFu; }
+  uint32_t operator()() {
+    if (next == LANES) {
+      fill_scalar(&rng, words, 1);
+      next = 0;
+    }
+    return words[next++];
+  }
+
+ private:
+  BatchRng rng;
+  uint32_t words[LANES];
+  int next;
+};
+
+// Appends the roll tiers of the first counted substat lines (2 bits per line) for which the lines
+// score at least threshold.
+void add_passing_tiers(const ScoreTables& tables, int lines, int counted, int threshold, std::vector<uint8_t>* passing) {
+  for (int tiers = 0; tiers < (1 << (2 * counted)); tiers++) {
+    int score = 0;
+    for (int j = 0; j < counted; j++)
+      score += tables.line[(lines >> (4*j)) & 15][(tiers >> (2*j)) & 3];
+    if (score >= threshold) passing->push_back(tiers);
+  }
+}
+
+// The substat lines of drops with a given mainstat and number of lines at +0, conditioned on
+// the lines scoring at least a threshold.
+struct LineTable {
+  // Chance of the lines reaching the threshold
+  double pass;
+  // Draws an entry: the lines of drops able to reach the threshold, with the roll tiers
+  // tiers[tier_begin[entry]], ..., tiers[tier_begin[entry+1]-1] that reach it
+  AliasTable entries;
+  std::vector<uint16_t> lines;
+  std::vector<int> tier_begin;
+  std::vector<uint8_t> tiers;
+};
+
+// Drops of one slot, mainstat, set, and number of lines that can become candidates.
+struct CandidateCell {
+  int mainstat;
+  Set set;
+  bool extra_substat;
+  // Score the lines must reach
+  int threshold;
+  const LineTable* lines;
+};
+
+// How the drops of one domain turn out, for each slot.
+struct DomainCandidates {
+  // Chances of a drop of the slot becoming a candidate [0], being leveled without becoming a candidate
+  // for its useless mainstat [1], or not being leveled [2]
+  double category[SLOT_CT][3];
+  // The kinds of candidates, and their chances among the candidates
+  std::vector<CandidateCell> cells[SLOT_CT];
+  AliasTable cell_table[SLOT_CT];
+};
+
+// Tables of the candidate generator for one farming config. Building them takes a few milliseconds,
+// so each thread keeps the tables of the last config it used.
+struct CandidateTables {
+  // The config the tables were built for
+  ScoreTables score;
+  int stat_score[MAINSTAT_CT];
+  int min_stat_score[SLOT_CT];
+  std::vector<Domain> domains;
+  bool built = false;
+
+  // Keyed by mainstat, whether the drop has 4 lines at +0, and threshold
+  std::map<std::tuple<int, bool, int>, LineTable> line_tables;
+  std::vector<DomainCandidates> domain_tables;
+
+  bool built_for(const FarmingConfig& fcfg, const ScoreTables& tables) const {
+    return built && domains == fcfg.domains
+           && std::equal(stat_score, stat_score + MAINSTAT_CT, fcfg.stat_score)
+           && std::equal(min_stat_score, min_stat_score + SLOT_CT, fcfg.min_stat_score)
+           && std::equal(score.mainstat, score.mainstat + MAINSTAT_CT, tables.mainstat)
+           && std::equal(score.set, score.set + SET_CT, tables.set)
+           && std::equal(&score.line[0][0], &score.line[0][0] + SUBSTAT_CT * 4, &tables.line[0][0]);
+  }
+
+  const LineTable* line_table(int mainstat, bool extra_substat, int threshold) {
+    auto key = std::make_tuple(mainstat, extra_substat, threshold);
+    auto it = line_tables.find(key);
+    if (it != line_tables.end()) return &it->second;
+
+    const DropTables& drop = drop_tables();
+    const int counted = extra_substat ? 4 : 3;
+    LineTable& table = line_tables[key];
+    table.pass = 0;
+    table.tier_begin.push_back(0);
+    std::vector<double> probs;
+    std::vector<uint16_t> outcomes;
+    for (unsigned int i = 0; i < drop.substat_lines[mainstat].size(); i++) {
+      const int lines = drop.substat_lines[mainstat][i];
+      add_passing_tiers(score, lines, counted, threshold, &table.tiers);
+      const int passing = table.tiers.size() - table.tier_begin.back();
+      if (passing == 0) continue;
+      const double p = drop.substat_probs[mainstat][i] * passing / (1 << (2 * counted));
+      table.pass += p;
+      probs.push_back(p);
+      outcomes.push_back(table.lines.size());
+      table.lines.push_back(lines);
+      table.tier_begin.push_back(table.tiers.size());
+    }
+    if (!probs.empty()) table.entries.build(probs, outcomes);
+    return &table;
+  }
+
+  void build(const FarmingConfig& fcfg, const ScoreTables& tables) {
+    score = tables;
+    std::copy(fcfg.stat_score, fcfg.stat_score + MAINSTAT_CT, stat_score);
+    std::copy(fcfg.min_stat_score, fcfg.min_stat_score + SLOT_CT, min_stat_score);
+    domains = fcfg.domains;
+    line_tables.clear();
+    domain_tables.assign(domains.size(), DomainCandidates());
+
+    for (unsigned int d = 0; d < domains.size(); d++) {
+      DomainCandidates& domain = domain_tables[d];
+      const double extra_chance = 1.0 / EXTRA_SUBSTAT_PROB[domains[d] == BOSS];
+      for (int slot = 0; slot < SLOT_CT; slot++) {
+        std::fill(domain.category[slot], domain.category[slot] + 3, 0.0);
+        std::vector<double> probs;
+        std::vector<uint16_t> outcomes;
+        for (int m = 0; m < MAINSTAT_CT; m++) {
+          const int weight = MAINSTAT_WEIGHT[slot][m] - (m > 0 ? MAINSTAT_WEIGHT[slot][m-1] : 0);
+          if (weight == 0) continue;
+          // Pieces with a useless mainstat never reach the optimizer
+          const bool useful = slot < SANDS || stat_score[m] != 0;
+          for (int s = 0; s < 2; s++) {
+            const Set set = DOMAIN_TO_SET[domains[d]][s];
+            for (int extra = 0; extra < 2; extra++) {
+              const double p = double(weight) / MAINSTAT_WEIGHT[slot][MAINSTAT_CT-1] / 2
+                               * (extra ? extra_chance : 1 - extra_chance);
+              const int threshold = min_stat_score[slot] - score.mainstat[m] - score.set[set];
+              const LineTable* lines = line_table(m, extra, threshold);
+              domain.category[slot][useful ? 0 : 1] += p * lines->pass;
+              domain.category[slot][2] += p * (1 - lines->pass);
+              if (!useful || lines->pass == 0) continue;
+              probs.push_back(p * lines->pass);
+              outcomes.push_back(domain.cells[slot].size());
+              domain.cells[slot].push_back({m, set, extra == 1, threshold, lines});
+            }
+          }
+        }
+        if (!probs.empty()) domain.cell_table[slot].build(probs, outcomes);
+      }
+    }
+    built = true;
+  }
+};
+
+thread_local CandidateTables candidate_tables;
+
+// Draws a +20 candidate of the given kind, conditioned on its lines reaching the threshold.
+void gen_candidate(const CandidateCell& cell, WordStream& words, Artifact* a) {
+  const LineTable& table = *cell.lines;
+  const int entry = table.entries.sample(words());
+  const int lines = table.lines[entry];
+  // A uniformly chosen one of the passing roll tiers of the counted lines
+  const int begin = table.tier_begin[entry];
+  int tiers = table.tiers[begin + bounded(words(), table.tier_begin[entry + 1] - begin)];
+  // Without an extra substat, the roll of the 4th line doesn't count toward the score
+  if (!cell.extra_substat) tiers |= (words() & 3) << 6;
+
+  *a = Artifact();
+  a->mainstat = static_cast<Stat>(cell.mainstat);
+  a->set = cell.set;
+  a->extra_substat = cell.extra_substat;
+  for (int j = 0; j < 4; j++) {
+    a->substats[j] = (lines >> (4*j)) & 15;
+    a->substat_values[a->substats[j]] = SUBSTAT_LEVEL[a->substats[j]][(tiers >> (2*j)) & 3];
+  }
+  level_to_20(a, words());
+}
+
+}  // namespace
+
+bool batch_rng_avx2() {
+#ifdef BATCH_RNG_AVX2
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+int gen_upgraded_batch(FarmingConfig& fcfg, int n, uint64_t seed, Artifact* upgraded, int upgrade_ratio[SLOT_CT][2]) {
+  BatchWorkspace& ws = workspace;
+  BatchRng rng;
+  seed_rng(&rng, seed);
+  ws.words.clear();
+  fill_words(&rng, n * WORDS_PER_ARTIFACT, &ws.words);
+
+  ws.slot.resize(n);
+  ws.mainstat.resize(n);
+  ws.set.resize(n);
+  ws.extra_substat.resize(n);
+  for (int j = 0; j < 4; j++) {
+    ws.substats[j].resize(n);
+    ws.tiers[j].resize(n);
+  }
+  ws.score.resize(n);
+
+  ScoreTables tables;
+  build_score_tables(fcfg, &tables);
+
+  // Pass 1: decode the random words into +0 artifacts. Outputs are written through local pointers,
+  // since byte stores could otherwise alias the vectors and force reloads.
+  const uint32_t* words = ws.words.data();
+  uint8_t* const slots = ws.slot.data();
+  uint8_t* const mainstats = ws.mainstat.data();
+  uint8_t* const sets = ws.set.data();
+  uint8_t* const extra_substats = ws.extra_substat.data();
+  uint8_t* const substats[4] = {ws.substats[0].data(), ws.substats[1].data(), ws.substats[2].data(), ws.substats[3].data()};
+  uint8_t* const tiers[4] = {ws.tiers[0].data(), ws.tiers[1].data(), ws.tiers[2].data(), ws.tiers[3].data()};
+  const int domain_ct = fcfg.domains.size();
+  const Domain* domains = fcfg.domains.data();
+  const DropTables& drop = drop_tables();
+  for (int i = 0, d = 0; i < n; i++, d = (d + 1 == domain_ct) ? 0 : d + 1) {
+    const uint32_t* w = words + i * WORDS_PER_ARTIFACT;
+    const Domain domain = domains[d];
+
+    const int slot = bounded(w[0], SLOT_CT);
+    const int mainstat = drop.mainstat[slot].sample(w[1]);
+    const int lines = drop.substats[mainstat].sample(w[4]);
+    for (int j = 0; j < 4; j++) {
+      substats[j][i] = (lines >> (4*j)) & 15;
+      tiers[j][i] = (w[2] >> (1 + 2*j)) & 3;
+    }
+    slots[i] = slot;
+    mainstats[i] = mainstat;
+    sets[i] = DOMAIN_TO_SET[domain][w[2] & 1];
+    extra_substats[i] = bounded(w[3], EXTRA_SUBSTAT_PROB[domain == BOSS]) == 0;
+  }
+
+  // Pass 2: score every artifact, counting the 4th substat only if present at +0
+  int* const scores = ws.score.data();
+  for (int i = 0; i < n; i++) {
+    scores[i] = tables.mainstat[mainstats[i]] + tables.set[sets[i]]
+                + tables.line[substats[0][i]][tiers[0][i]]
+                + tables.line[substats[1][i]][tiers[1][i]]
+                + tables.line[substats[2][i]][tiers[2][i]]
+                + (extra_substats[i] ? tables.line[substats[3][i]][tiers[3][i]] : 0);
+  }
+  ws.survivors.clear();
+  for (int i = 0; i < n; i++) {
+    upgrade_ratio[slots[i]][1]++;
+    if (scores[i] >= fcfg.min_stat_score[slots[i]]) ws.survivors.push_back(i);
+  }
+
+  // Pass 3: level the survivors to +20, using one more word each for the 4 bit choices
+  // (line and roll tier) of up to 5 upgrades
+  const int survivor_ct = ws.survivors.size();
+  ws.words.clear();
+  fill_words(&rng, survivor_ct, &ws.words);
+  for (int k = 0; k < survivor_ct; k++) {
+    const int i = ws.survivors[k];
+    Artifact& a = upgraded[k];
+    a = Artifact();
+    a.slot = static_cast<Slot>(slots[i]);
+    a.mainstat = static_cast<Stat>(mainstats[i]);
+    a.set = static_cast<Set>(sets[i]);
+    a.extra_substat = extra_substats[i];
+    for (int j = 0; j < 4; j++) {
+      a.substats[j] = substats[j][i];
+      a.substat_values[a.substats[j]] = SUBSTAT_LEVEL[a.substats[j]][tiers[j][i]];
+    }
+    level_to_20(&a, ws.words[k]);
+    a.stat_score = fcfg.score(a);
+    upgrade_ratio[a.slot][0]++;
+  }
+  return survivor_ct;
+}
+
+int gen_candidate_batch(FarmingConfig& fcfg, int n, uint64_t seed, Artifact* candidates, int upgrade_ratio[SLOT_CT][2]) {
+  ScoreTables tables;
+  build_score_tables(fcfg, &tables);
+  CandidateTables& candidate = candidate_tables;
+  if (!candidate.built_for(fcfg, tables)) candidate.build(fcfg, tables);
+
+  WordStream words(seed);
+  int size = 0;
+  const int domain_ct = fcfg.domains.size();
+  for (int d = 0; d < domain_ct; d++) {
+    const DomainCandidates& domain = candidate.domain_tables[d];
+    // Split the drops from the domain between the slots and categories, one binomial draw at a time
+    int left = n / domain_ct + (d < n % domain_ct ? 1 : 0);
+    double chance_left = 1.0;
+    for (int slot = 0; slot < SLOT_CT; slot++) {
+      for (int category = 0; category < 3; category++) {
+        const double p = domain.category[slot][category] / SLOT_CT;
+        int count = left;
+        if (slot < SLOT_CT - 1 || category < 2) {
+          const double conditional = (chance_left > 0) ? std::min(1.0, std::max(0.0, p / chance_left)) : 1.0;
+          count = (left > 0 && conditional > 0) ? std::binomial_distribution<int>(left, conditional)(words) : 0;
+        }
+        chance_left -= p;
+        left -= count;
+        upgrade_ratio[slot][1] += count;
+        if (category == 2) continue;
+        upgrade_ratio[slot][0] += count;
+        if (category == 1) continue;
+
+        for (int i = 0; i < count; i++) {
+          Artifact& a = candidates[size++];
+          gen_candidate(domain.cells[slot][domain.cell_table[slot].sample(words())], words, &a);
+          a.slot = static_cast<Slot>(slot);
+          a.stat_score = fcfg.score(a);
+        }
+      }
+    }
+  }
+  return size;
+}
@@ -0,0 +1,37 @@
+#ifndef __GEN_BATCH_H__
+#define __GEN_BATCH_H__
+
+#include <cstdint>
+
+#include "types.h"
+
+// Batch artifact generator. Instead of generating and leveling one artifact at a time, a whole
+// farming run of +0 artifacts is generated into structure of arrays buffers from an 8 lane
+// xoshiro128** generator (AVX2 when the CPU supports it, with a scalar fallback giving identical
+// results). Mainstats and substats are drawn from precomputed alias tables, artifacts are scored
+// from lookup tables, and only the pieces passing min_stat_score are leveled in a second pass.
+// Artifacts follow the same distribution as gen_random and upgrade_full, but a seed gives
+// different artifacts than it does with the scalar generator.
+
+// Generates n artifacts from the farming config's domains in round robin, starting with the first,
+// using the random stream of the given seed. The artifacts passing min_stat_score are leveled to +20,
+// scored, and written to upgraded, which must have room for n artifacts. Returns the number written.
+// Adds the number of upgraded and farmed artifacts of each slot to upgrade_ratio.
+int gen_upgraded_batch(FarmingConfig& fcfg, int n, uint64_t seed, Artifact* upgraded, int upgrade_ratio[SLOT_CT][2]);
+
+// Candidate generator. Like gen_upgraded_batch, but only draws the pieces that reach the optimizer:
+// +20 pieces that passed min_stat_score, without a useless sands, goblet, or circlet mainstat.
+// The exact chance of becoming a candidate is computed once per config for every slot, mainstat,
+// set, and number of lines at +0. The number of candidates and of other leveled and unleveled
+// pieces of each slot are then drawn with binomial draws, and only the candidates are drawn, from
+// the distribution of a drop conditioned on becoming a candidate. Takes time in proportion to
+// the number of candidates instead of n. The candidates follow the same distribution as those
+// of gen_upgraded_batch, and the counts in upgrade_ratio that of the drops, but a seed gives
+// different artifacts than with either other generator.
+// Writes the candidates to candidates, which must have room for n artifacts, and returns their number.
+int gen_candidate_batch(FarmingConfig& fcfg, int n, uint64_t seed, Artifact* candidates, int upgrade_ratio[SLOT_CT][2]);
+
+// Returns whether the AVX2 random number kernel is used on this CPU.
+bool batch_rng_avx2();
+
+#endif
@@ -0,0 +1,117 @@
+#include "jobs.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Job {
+  int id;
+  std::string command;
+  std::chrono::steady_clock::time_point start;
+  JobProgress progress;
+  std::atomic<bool> finished;
+  std::thread thread;
+
+  Job(int i, const std::string& cmd, int64_t total_iterations)
+      : id(i), command(cmd), start(std::chrono::steady_clock::now()), progress(total_iterations), finished(false) {}
+};
+
+// Jobs are only started, listed, and cancelled by the REPL thread, so the list needs no lock.
+std::vector<std::unique_ptr<Job>> jobs;
+
+Job* find_job(int id) {
+  if (id < 1 || id > (int) jobs.size()) return nullptr;
+  return jobs[id - 1].get();
+}
+
+std::string job_state(const Job& job) {
+  if (!job.finished) return job.progress.is_cancelled() ? "cancelling" : "running";
+  return job.progress.is_cancelled() ? "cancelled" : "done";
+}
+
+}  // namespace
+
+int start_job(const std::string& command, int64_t total_iterations, std::function<void(JobProgress&)> work) {
+  jobs.emplace_back(new Job(jobs.size() + 1, command, total_iterations));
+  Job* job = jobs.back().get();
+  job->thread = std::thread([job, work] {
+    work(job->progress);
+    job->finished = true;
+    {
+      std::lock_guard<std::mutex> lock(job_output_mutex());
+      std::cerr << "[job " << job->id << " " << job_state(*job) << " after "
+                << std::chrono::duration_cast<std::chrono::duration<double>>(
+                       std::chrono::steady_clock::now() - job->start).count()
+                << "s: " << job->command << "]" << std::endl << std::endl;
+    }
+  });
+  return job->id;
+}
+
+void print_jobs() {
+  if (jobs.empty()) {
+    std::cerr << "No jobs started." << std::endl;
+    return;
+  }
+  for (const auto& job : jobs) {
+    const int64_t done = job->progress.iterations_done.load(std::memory_order_relaxed);
+    std::cerr << "[" << job->id << "] " << job_state(*job) << " " << done << "/"
+              << job->progress.total_iterations << " | " << job->command << std::endl;
+  }
+}
+
+bool print_job_status(int id) {
+  const Job* job = find_job(id);
+  if (job == nullptr) return false;
+
+  const JobProgress& progress = job->progress;
+  const int64_t done = progress.iterations_done.load(std::memory_order_relaxed);
+  const int64_t artifacts = progress.artifacts.load(std::memory_order_relaxed);
+  const int64_t leaf_sets = progress.leaf_sets.load(std::memory_order_relaxed);
+  const double elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(
+      std::chrono::steady_clock::now() - job->start).count();
+
+  std::cerr << "Job " << job->id << ": " << job->command << " (" << job_state(*job) << ")" << std::endl;
+  std::cerr << "Iterations: " << done << "/" << progress.total_iterations;
+  if (progress.total_iterations > 0)
+    std::cerr << " (" << int(1000.0 * done / progress.total_iterations) / 10.0 << "%)";
+  std::cerr << std::endl;
+  std::cerr << "Elapsed: " << elapsed << "s" << std::endl;
+  if (elapsed > 0) {
+    std::cerr << "Artifacts/s: " << artifacts / elapsed << " | Sets evaluated/s: " << leaf_sets / elapsed << std::endl;
+  }
+  if (!job->finished && done > 0) {
+    std::cerr << "ETA: " << elapsed * (progress.total_iterations - done) / done << "s" << std::endl;
+  }
+  return true;
+}
+
+bool cancel_job(int id) {
+  Job* job = find_job(id);
+  if (job == nullptr || job->finished) return false;
+  job->progress.cancelled = true;
+  return true;
+}
+
+bool job_running(const std::string& command) {
+  for (const auto& job : jobs) {
+    if (job->finished) continue;
+    if (command.empty() || job->command.compare(0, command.size() + 1, command + " ") == 0) return true;
+  }
+  return false;
+}
+
+void wait_for_jobs() {
+  for (const auto& job : jobs) {
+    if (job->thread.joinable()) job->thread.join();
+  }
+}
+
+std::mutex& job_output_mutex() {
+  static std::mutex output_mutex;
+  return output_mutex;
+}
@@ -0,0 +1,49 @@
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+// Progress of a command, updated by the thread running it and read by the REPL.
+// The counters are relaxed atomics, so updating them once per iteration costs about as much
+// as a plain add and never blocks the worker.
+struct JobProgress {
+  int64_t total_iterations;
+  std::atomic<int64_t> iterations_done;
+  std::atomic<int64_t> artifacts;
+  // Complete sets evaluated by the optimizer
+  std::atomic<int64_t> leaf_sets;
+  std::atomic<bool> cancelled;
+
+  explicit JobProgress(int64_t total)
+      : total_iterations(total), iterations_done(0), artifacts(0), leaf_sets(0), cancelled(false) {}
+
+  void add(int64_t iterations, int64_t artifact_ct, int64_t leaf_set_ct) {
+    iterations_done.fetch_add(iterations, std::memory_order_relaxed);
+    artifacts.fetch_add(artifact_ct, std::memory_order_relaxed);
+    leaf_sets.fetch_add(leaf_set_ct, std::memory_order_relaxed);
+  }
+  bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+};
+
+// Runs work on a new thread as a background job and returns its id.
+// work should check progress.is_cancelled() regularly, and report what it has done so far when cancelled.
+int start_job(const std::string& command, int64_t total_iterations, std::function<void(JobProgress&)> work);
+// Prints one line for every job started so far.
+void print_jobs();
+// Prints the progress, throughput, and estimated time left of a job. Returns false if there is no such job.
+bool print_job_status(int id);
+// Asks a running job to stop. Returns false if there is no such job or it already finished.
+bool cancel_job(int id);
+// Returns whether a job of the given command, e.g. "farm_script", or any job if command is empty, is still running.
+bool job_running(const std::string& command);
+// Waits for all jobs to finish.
+void wait_for_jobs();
+
+// Held by jobs while they print their results, so that the output of jobs finishing together isn't interleaved.
+std::mutex& job_output_mutex();
+
+#endif
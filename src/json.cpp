@@ -0,0 +1,240 @@
+#include "json.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+struct JsonParser {
+  const std::string& s;
+  size_t pos;
+
+  void skip_whitespace() {
+    while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r'))
+      pos++;
+  }
+
+  bool consume(const char* literal) {
+    size_t i = 0;
+    while (literal[i] != '\0') {
+      if (pos + i >= s.size() || s[pos + i] != literal[i]) return false;
+      i++;
+    }
+    pos += i;
+    return true;
+  }
+
+  // Appends the UTF-8 encoding of a code point
+  static void append_utf8(std::string* out, unsigned int cp) {
+    if (cp < 0x80) {
+      *out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+      *out += static_cast<char>(0xC0 | (cp >> 6));
+      *out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+      *out += static_cast<char>(0xE0 | (cp >> 12));
+      *out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      *out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+
+  // Skips the digits at pos, returning whether there was at least one
+  bool skip_digits() {
+    const size_t start = pos;
+    while (pos < s.size() && s[pos] >= '0' && s[pos] <= '9')
+      pos++;
+    return pos > start;
+  }
+
+  // Parses a number in the JSON grammar. strtod alone would also accept nan, inf, hex, and a
+  // leading +, which json_dump could then write back as invalid JSON.
+  bool parse_number(double* number) {
+    const size_t start = pos;
+    consume("-");
+    if (!consume("0") && !skip_digits()) return false;
+    if (consume(".") && !skip_digits()) return false;
+    if (consume("e") || consume("E")) {
+      if (!consume("+")) consume("-");
+      if (!skip_digits()) return false;
+    }
+    *number = std::strtod(s.substr(start, pos - start).c_str(), nullptr);
+    // Out of range numbers become infinite
+    return std::isfinite(*number);
+  }
+
+  bool parse_string(std::string* out) {
+    if (pos >= s.size() || s[pos] != '"') return false;
+    pos++;
+    while (pos < s.size()) {
+      char c = s[pos++];
+      if (c == '"') return true;
+      if (c != '\\') {
+        *out += c;
+        continue;
+      }
+      if (pos >= s.size()) return false;
+      char e = s[pos++];
+      switch (e) {
+        case '"': *out += '"'; break;
+        case '\\': *out += '\\'; break;
+        case '/': *out += '/'; break;
+        case 'b': *out += '\b'; break;
+        case 'f': *out += '\f'; break;
+        case 'n': *out += '\n'; break;
+        case 'r': *out += '\r'; break;
+        case 't': *out += '\t'; break;
+        case 'u': {
+          if (pos + 4 > s.size()) return false;
+          char* end = nullptr;
+          const std::string hex = s.substr(pos, 4);
+          unsigned int cp = std::strtoul(hex.c_str(), &end, 16);
+          if (end != hex.c_str() + 4) return false;
+          append_utf8(out, cp);
+          pos += 4;
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+
+  bool parse_value(JsonValue* value, int depth) {
+    // Limit nesting so that malicious input cannot overflow the stack
+    if (depth > 64) return false;
+    skip_whitespace();
+    if (pos >= s.size()) return false;
+
+    const char c = s[pos];
+    if (c == '{') {
+      pos++;
+      value->type = JsonValue::OBJECT;
+      skip_whitespace();
+      if (pos < s.size() && s[pos] == '}') {
+        pos++;
+        return true;
+      }
+      while (true) {
+        skip_whitespace();
+        std::pair<std::string, JsonValue> member;
+        if (!parse_string(&member.first)) return false;
+        skip_whitespace();
+        if (!consume(":")) return false;
+        if (!parse_value(&member.second, depth + 1)) return false;
+        value->object.push_back(member);
+        skip_whitespace();
+        if (consume(",")) continue;
+        return consume("}");
+      }
+    }
+    if (c == '[') {
+      pos++;
+      value->type = JsonValue::ARRAY;
+      skip_whitespace();
+      if (pos < s.size() && s[pos] == ']') {
+        pos++;
+        return true;
+      }
+      while (true) {
+        JsonValue element;
+        if (!parse_value(&element, depth + 1)) return false;
+        value->array.push_back(element);
+        skip_whitespace();
+        if (consume(",")) continue;
+        return consume("]");
+      }
+    }
+    if (c == '"') {
+      value->type = JsonValue::STRING;
+      return parse_string(&value->str);
+    }
+    if (consume("true")) {
+      value->type = JsonValue::BOOLEAN;
+      value->boolean = true;
+      return true;
+    }
+    if (consume("false")) {
+      value->type = JsonValue::BOOLEAN;
+      value->boolean = false;
+      return true;
+    }
+    if (consume("null")) {
+      value->type = JsonValue::NUL;
+      return true;
+    }
+
+    value->type = JsonValue::NUMBER;
+    return parse_number(&value->number);
+  }
+};
+
+}  // namespace
+
+const JsonValue* JsonValue::get(const std::string& key) const {
+  if (type != OBJECT) return nullptr;
+  for (const auto& member : object) {
+    if (member.first == key) return &member.second;
+  }
+  return nullptr;
+}
+
+bool parse_json(const std::string& s, JsonValue* value) {
+  *value = JsonValue();
+  JsonParser parser = {s, 0};
+  if (!parser.parse_value(value, 0)) return false;
+  parser.skip_whitespace();
+  return parser.pos == s.size();
+}
+
+std::string json_string(const std::string& s) {
+  std::string out = "\"";
+  for (char c : s) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out += c;
+        }
+    }
+  }
+  return out + "\"";
+}
+
+std::string json_dump(const JsonValue& value) {
+  switch (value.type) {
+    case JsonValue::NUL:
+      return "null";
+    case JsonValue::BOOLEAN:
+      return value.boolean ? "true" : "false";
+    case JsonValue::NUMBER: {
+      char buf[32];
+      std::snprintf(buf, sizeof(buf), "%.17g", value.number);
+      return buf;
+    }
+    case JsonValue::STRING:
+      return json_string(value.str);
+    case JsonValue::ARRAY: {
+      std::string out = "[";
+      for (unsigned int i = 0; i < value.array.size(); i++)
+        out += (i > 0 ? "," : "") + json_dump(value.array[i]);
+      return out + "]";
+    }
+    case JsonValue::OBJECT: {
+      std::string out = "{";
+      for (unsigned int i = 0; i < value.object.size(); i++)
+        out += (i > 0 ? "," : "") + json_string(value.object[i].first) + ":" + json_dump(value.object[i].second);
+      return out + "}";
+    }
+  }
+  return "null";
+}
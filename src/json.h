@@ -0,0 +1,35 @@
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// A parsed JSON value. Only the member matching the type is used.
+struct JsonValue {
+  enum Type {
+    NUL = 0, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT
+  };
+
+  Type type;
+  bool boolean;
+  double number;
+  std::string str;
+  std::vector<JsonValue> array;
+  std::vector<std::pair<std::string, JsonValue>> object;
+
+  JsonValue() : type(NUL), boolean(false), number(0.0) {}
+
+  // Returns the member with the given key, or nullptr if this is not an object with that key.
+  const JsonValue* get(const std::string& key) const;
+};
+
+// Parses a complete JSON document. Returns false on syntax errors or trailing characters.
+bool parse_json(const std::string& s, JsonValue* value);
+
+// Returns s as a quoted and escaped JSON string.
+std::string json_string(const std::string& s);
+// Returns value serialized as compact JSON.
+std::string json_dump(const JsonValue& value);
+
+#endif
@@ -1,22 +1,68 @@
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "analyze.h"
 #include "farm.h"
 #include "gen_artifact.h"
+#include "gen_batch.h"
+#include "jobs.h"
+#include "pipeline.h"
+#include "policy.h"
+#include "result_cache.h"
+#include "scheduler.h"
+#include "server.h"
 #include "text_io.h"
+#include "tune.h"
 #include "types.h"
+#include "verify.h"
 
 namespace {
 
 MainConfig main_config;
 Character character = {};
 Weapon weapon = {};
+// Pre-generated drops shared by all configs, used instead of the RNG when enabled
+DropCache drop_cache = {};
+bool use_drop_cache = false;
+// Seed of the random substreams used by farm and farm_script iterations
+uint64_t master_seed = 0;
+// Generator used by seeded farm and farm_script iterations
+Generator generator = GENERATOR_SCALAR;
+// Importance sampling tilt toward crit upgrades used by farm, 1 when off
+double crit_tilt = 1.0;
+// Whether farm and farm_script reuse and store results in cache/
+bool use_result_cache = true;
+// Bootstrap pool farm and farm_script draw their drops from instead, when its drops are not 0
+BootstrapSettings bootstrap_settings = {0, BOOTSTRAP_REPLICATES, false};
+
+// Number of best sets farm_one reports by default
+constexpr int FARM_ONE_TOP_K = 5;
+// Largest n_artifacts farm_one reports FARM_ONE_TOP_K sets for by default. The k best sets are searched
+// on one thread, which gets slow for larger n, so only the best set is searched for, on all threads.
+constexpr int FARM_ONE_TOP_K_MAX_N = 1000;
+// Minimum time between farm_script checkpoints
+constexpr int CHECKPOINT_SECONDS = 60;
+// Iterations of every n a farm_script sweep times to learn how the cost of an iteration grows with n
+constexpr int COST_PROBE_ITERATIONS = 4;
+// Batches per worker the rest of a farm_script sweep is split into. More batches even out the
+// finishing times of the workers when the learned costs are off, fewer take less merging.
+constexpr int SWEEP_BATCHES_PER_WORKER = 16;
+// Time between merging the finished batches of a farm_script sweep
+constexpr int SWEEP_POLL_MILLISECONDS = 500;
+// Resin spent on one artifact domain run, and the average number of 5 star artifacts it drops (x100)
+constexpr int RESIN_PER_RUN = 20;
+constexpr int ARTIFACTS_PER_RUN_X100 = 107;
 
 // Initialize all configs
 bool initialize_configs() {
@@ -28,9 +74,843 @@ bool initialize_configs() {
     std::cerr << "Error reading weapon config." << std::endl;
     return false;
   }
+  if (character.farming_config.derive_stat_score) apply_derived_stat_weights(character, weapon);
+  return true;
+}
+
+// Everything a farming command reads. Background jobs get their own copy, so that the REPL
+// can change configs, the seed, or the artifact cache while they run.
+struct RunContext {
+  std::string character_name;
+  std::string weapon_name;
+  Character character;
+  Weapon weapon;
+  uint64_t master_seed;
+  Generator generator;
+  double crit_tilt;
+  bool use_drop_cache;
+  DropCache* drop_cache;
+  bool use_result_cache;
+  BootstrapSettings bootstrap;
+  // The pool built for the bootstrap settings, if the running command built one
+  const BootstrapPool* bootstrap_pool;
+};
+
+RunContext current_context() {
+  return {main_config.character, main_config.weapon, character, weapon, master_seed, generator, crit_tilt,
+          use_drop_cache, &drop_cache, use_result_cache, bootstrap_settings, nullptr};
+}
+
+// Farm one iteration of a command, taking drops from the bootstrap pool or artifact cache if enabled.
+FarmedSet farm_iteration(RunContext& ctx, int n, int iter) {
+  if (ctx.bootstrap_pool != nullptr) return farm(ctx.character, ctx.weapon, n, *ctx.bootstrap_pool, iter);
+  if (ctx.use_drop_cache) return farm(ctx.character, ctx.weapon, n, *ctx.drop_cache, iter);
+  return farm(ctx.character, ctx.weapon, n, ctx.master_seed, iter, ctx.generator);
+}
+
+// Farm the candidates of the same iteration as farm_iteration into the workspace, for optimize_candidates.
+void farm_iteration_candidates(RunContext& ctx, int n, int iter, FarmWorkspace* workspace) {
+  if (ctx.bootstrap_pool != nullptr) {
+    farm_candidates(ctx.character, n, *ctx.bootstrap_pool, iter, workspace);
+  } else if (ctx.use_drop_cache) {
+    farm_candidates(ctx.character, n, *ctx.drop_cache, iter, workspace);
+  } else {
+    farm_candidates(ctx.character, n, ctx.master_seed, iter, ctx.generator, workspace);
+  }
+}
+
+// Hash of everything the context's farm iterations of n artifacts depend on.
+uint64_t result_hash(RunContext& ctx, int n) {
+  return result_key_hash({&ctx.character, &ctx.weapon, n, ctx.master_seed, ctx.generator,
+                          ctx.use_drop_cache, ctx.drop_cache->seed});
+}
+
+// Loads the cached results of the first farm iterations of n artifacts into acc, unless more than
+// iters are cached. Returns the number of iterations loaded.
+int load_cached_iterations(RunContext& ctx, int n, int iters, FarmedSetAccumulator* acc) {
+  ShardResult cached;
+  if (!read_cached_result(result_hash(ctx, n), &cached) || cached.iters > iters) return 0;
+  *acc = cached.accumulators[0];
+  return cached.iters;
+}
+
+// Caches the results of the first acc.count farm iterations of n artifacts, warning if they could not be written.
+void store_cached_iterations(RunContext& ctx, int n, const FarmedSetAccumulator& acc) {
+  ShardResult result = {"farm", ctx.character_name, ctx.weapon_name, ctx.master_seed, ctx.generator,
+                        (int) acc.count, 0, 1, {n}, {acc}};
+  if (!write_cached_result(result_hash(ctx, n), result)) {
+    std::cerr << "Warning: failed to write cached results " << cached_result_file(result_hash(ctx, n)) << std::endl;
+  }
+}
+
+// Parse an optional "--shard i/N" argument, which runs only the i-th of N parts of the iterations.
+bool parse_shard(const std::vector<std::string>& input_list, int* shard, int* shard_ct) {
+  auto it = std::find(input_list.begin(), input_list.end(), "--shard");
+  if (it == input_list.end()) return true;
+  std::vector<std::string> shard_pair;
+  if (it + 1 != input_list.end()) shard_pair = split(*(it + 1), '/');
+  if (shard_pair.size() == 2) {
+    *shard = std::stoi(shard_pair[0]);
+    *shard_ct = std::stoi(shard_pair[1]);
+    if (*shard >= 0 && *shard < *shard_ct) return true;
+  }
+  std::cerr << "Invalid shard given, expected --shard <i>/<N> with 0 <= i < N." << std::endl << std::endl;
+  return false;
+}
+
+// Parse an optional "--pipeline p/c" argument, which runs iterations on p producer and c consumer
+// threads (see run_pipeline), leaving producers and consumers unchanged if it isn't given.
+bool parse_pipeline(const std::vector<std::string>& input_list, int* producers, int* consumers) {
+  auto it = std::find(input_list.begin(), input_list.end(), "--pipeline");
+  if (it == input_list.end()) return true;
+  std::vector<std::string> thread_pair;
+  if (it + 1 != input_list.end()) thread_pair = split(*(it + 1), '/');
+  if (thread_pair.size() == 2) {
+    *producers = std::atoi(thread_pair[0].c_str());
+    *consumers = std::atoi(thread_pair[1].c_str());
+    if (*producers > 0 && *consumers > 0) return true;
+  }
+  std::cerr << "Invalid pipeline given, expected --pipeline <p>/<c> with p, c > 0." << std::endl << std::endl;
+  return false;
+}
+
+// Parse an optional "--threads k" argument, leaving threads unchanged if it isn't given.
+bool parse_threads(const std::vector<std::string>& input_list, int* threads) {
+  auto it = std::find(input_list.begin(), input_list.end(), "--threads");
+  if (it == input_list.end()) return true;
+  if (it + 1 != input_list.end() && !(it + 1)->empty()
+      && std::all_of((it + 1)->begin(), (it + 1)->end(), [](char ch) { return ch >= '0' && ch <= '9'; })) {
+    *threads = std::stoi(*(it + 1));
+    return true;
+  }
+  std::cerr << "Invalid thread count given, expected --threads <k>." << std::endl << std::endl;
+  return false;
+}
+
+// Parse optional "--approx <gap%>" and "--budget <sets>" arguments for the approximate optimizer (see
+// set_optimizer_gap), leaving gap and max_sets unchanged if they aren't given.
+bool parse_approx(const std::vector<std::string>& input_list, double* gap, int64_t* max_sets) {
+  auto it = std::find(input_list.begin(), input_list.end(), "--approx");
+  if (it != input_list.end()) {
+    const double percent = (it + 1 != input_list.end()) ? std::atof((it + 1)->c_str()) : 0.0;
+    if (percent <= 0 || percent >= 100) {
+      std::cerr << "Invalid gap given, expected --approx <gap%> with 0 < gap% < 100." << std::endl << std::endl;
+      return false;
+    }
+    *gap = percent / 100;
+  }
+  it = std::find(input_list.begin(), input_list.end(), "--budget");
+  if (it != input_list.end()) {
+    const long long sets = (it + 1 != input_list.end()) ? std::atoll((it + 1)->c_str()) : 0;
+    if (sets <= 0) {
+      std::cerr << "Invalid budget given, expected --budget <sets> with sets > 0." << std::endl << std::endl;
+      return false;
+    }
+    *max_sets = sets;
+  }
+  return true;
+}
+
+// Returns whether a farm or farm_script run of up to n artifacts can use the bootstrap pool, if enabled.
+bool valid_bootstrap_run(int n, int shard_ct) {
+  if (bootstrap_settings.drops == 0) return true;
+  // Shard files don't record the pool, so shards of bootstrap runs could be merged with others
+  if (shard_ct > 1) {
+    std::cerr << "The bootstrap pool doesn't work with shards." << std::endl << std::endl;
+    return false;
+  }
+  if (bootstrap_settings.windows && n > bootstrap_settings.drops) {
+    std::cerr << "Windows of " << n << " drops don't fit in replicates of " << bootstrap_settings.drops
+              << " drops." << std::endl << std::endl;
+    return false;
+  }
   return true;
 }
 
+// Save farm_script progress, warning if it could not be written.
+void save_checkpoint(const std::string& filename, const ScriptCheckpoint& checkpoint) {
+  if (!write_checkpoint(filename, checkpoint)) {
+    std::cerr << "Warning: failed to write checkpoint " << filename << std::endl;
+  }
+}
+
+// Write the partial results of a shard to <command>_shard_<i>_of_<N>.txt
+void write_shard(const ShardResult& result) {
+  const std::string filename = result.command + "_shard_" + std::to_string(result.shard)
+                               + "_of_" + std::to_string(result.shard_ct) + ".txt";
+  if (write_shard_result(filename, result)) {
+    std::cerr << "Shard results written to " << filename << std::endl << std::endl;
+  } else {
+    std::cerr << "Error: failed to write shard results to " << filename << std::endl << std::endl;
+  }
+}
+
+// Make sure the artifact cache, if enabled and not replaced by a bootstrap pool, holds enough drops for the command.
+bool prepare_drop_cache(RunContext& ctx, int n, int iters) {
+  if (!ctx.use_drop_cache || ctx.bootstrap.drops > 0) return true;
+  if (open_drop_cache(ctx.character.farming_config.domains, n, iters, ctx.drop_cache)) return true;
+  std::cerr << "Error: artifact cache unavailable." << std::endl << std::endl;
+  return false;
+}
+
+// Farm the bootstrap pool of the command into pool on the given number of threads, if bootstrap is
+// enabled, and have the context's iterations draw from it.
+void prepare_bootstrap_pool(RunContext& ctx, int threads, BootstrapPool* pool) {
+  if (ctx.bootstrap.drops == 0) return;
+  auto start = std::chrono::steady_clock::now();
+  build_bootstrap_pool(ctx.character.farming_config, ctx.bootstrap, ctx.master_seed, threads, pool);
+  ctx.bootstrap_pool = pool;
+  std::cerr << "Farmed a bootstrap pool of " << ctx.bootstrap.replicates << " x " << ctx.bootstrap.drops
+            << " drops in " << std::chrono::duration_cast<std::chrono::duration<double>>(
+                                   std::chrono::steady_clock::now() - start).count()
+            << "s." << std::endl;
+}
+
+// Standard deviation of the values divided by the square root of their number: the standard error
+// of their mean, if they are independent.
+double standard_error(const std::vector<double>& values) {
+  double sum = 0.0, sum_sq = 0.0;
+  for (double v : values) {
+    sum += v;
+    sum_sq += v * v;
+  }
+  const double mean = sum / values.size();
+  const double variance = std::max(0.0, (sum_sq - values.size() * mean * mean) / (values.size() - 1));
+  return std::sqrt(variance / values.size());
+}
+
+// Print how much the statistics of a bootstrap run vary between the replicates of its pool. The run's
+// mean is the mean of the replicates' means, so their spread gives its standard error, including the
+// error from the pool being a sample itself. That is compared to the error the iterations alone would
+// have with fresh drops, estimated from the spread of the damage.
+void print_bootstrap_errors(const BootstrapSettings& settings, int n, const FarmedSetStats& stats,
+                            const std::vector<FarmedSetAccumulator>& replicate_accs) {
+  std::cerr << "Bootstrap pool: " << settings.replicates << " replicates of " << settings.drops << " drops, ";
+  if (settings.windows) {
+    std::cerr << "windows of " << n << " drops" << std::endl;
+  } else {
+    std::cerr << "drawn with replacement, " << 100 * bootstrap_repeat_fraction(settings.drops, n)
+              << "% of the draws of an iteration repeat a drop" << std::endl;
+  }
+  std::vector<double> means, p5, medians, p95;
+  int64_t iterations = 0;
+  for (const FarmedSetAccumulator& replicate_acc : replicate_accs) {
+    if (replicate_acc.count < 2) {
+      std::cerr << "Too few iterations for error estimates, at least 2 per replicate are needed."
+                << std::endl << std::endl;
+      return;
+    }
+    const FarmedSetStats replicate = analyze_farmed_set(replicate_acc);
+    means.push_back(replicate.mean);
+    p5.push_back(replicate.percentiles[5]);
+    medians.push_back(replicate.percentiles[50]);
+    p95.push_back(replicate.percentiles[95]);
+    iterations += replicate_acc.count;
+  }
+  const double mean_error = standard_error(means);
+  const double iteration_error = stats.stddev / std::sqrt((double) iterations);
+  std::cerr << "Standard errors across replicates: mean " << mean_error << " (" << iteration_error
+            << " from the iterations alone), 5%ile " << standard_error(p5) << ", median "
+            << standard_error(medians) << ", 95%ile " << standard_error(p95) << std::endl;
+  // Without error from the pool, the ratio is about 1, and with BOOTSTRAP_REPLICATES replicates rarely above 2
+  if (mean_error > 2 * iteration_error) {
+    std::cerr << "Warning: the pool adds more error than the iterations, use more drops per replicate." << std::endl;
+  }
+  std::cerr << std::endl;
+}
+
+void print_time(std::chrono::steady_clock::time_point start) {
+  std::cerr << "Time: "
+            << std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count()
+            << "s" << std::endl;
+}
+
+// What a farm command adds up over its iterations.
+struct FarmTotals {
+  FarmedSetAccumulator acc;
+  // The same for the iterations of each replicate of the bootstrap pool, if there is one
+  std::vector<FarmedSetAccumulator> replicate_accs;
+  // Certified gap of each approximate set: how far below its damage bound it may be
+  double gap_total;
+  double gap_max;
+
+  FarmTotals() : gap_total(0.0), gap_max(0.0) {}
+
+  void add(Character& c, int iter, const FarmedSet& set) {
+    acc.add(c, set);
+    if (!replicate_accs.empty()) replicate_accs[iter % replicate_accs.size()].add(c, set);
+    if (set.damage_bound > 0) {
+      const double set_gap = 1.0 - (double) set.damage / set.damage_bound;
+      gap_total += set_gap;
+      gap_max = std::max(gap_max, set_gap);
+    }
+  }
+
+  void merge(const FarmTotals& other) {
+    acc.merge(other.acc);
+    for (unsigned int i = 0; i < replicate_accs.size(); i++)
+      replicate_accs[i].merge(other.replicate_accs[i]);
+    gap_total += other.gap_total;
+    gap_max = std::max(gap_max, other.gap_max);
+  }
+};
+
+// Runs the iterations of a farm command in [begin, end), stopping early if cancelled. With a gap or
+// max_sets, the sets are found by the approximate optimizer, and its certified gaps are printed.
+// With producers and consumers, the iterations run pipelined on that many threads (see run_pipeline),
+// with the same results as on one thread.
+void run_farm(RunContext& ctx, int iters, int n, int shard, int shard_ct, double gap, int64_t max_sets,
+              int producers, int consumers, JobProgress& progress) {
+  if (!prepare_drop_cache(ctx, n, iters)) return;
+
+  auto start = std::chrono::steady_clock::now();
+
+  int begin = 0, end = 0;
+  shard_iterations(iters, shard, shard_ct, &begin, &end);
+  FarmTotals totals;
+  FarmedSetAccumulator& acc = totals.acc;
+  acc.importance_sampled = (ctx.crit_tilt != 1.0);
+  const bool approximate = gap > 0 || max_sets > 0;
+  const bool pipelined = producers > 0 && consumers > 0;
+  BootstrapPool pool;
+  prepare_bootstrap_pool(ctx, 0, &pool);
+  totals.replicate_accs.resize(ctx.bootstrap_pool != nullptr ? ctx.bootstrap.replicates : 0);
+  // Every consumer of a pipelined run adds up the iterations it searches, starting from no iterations
+  std::vector<FarmTotals> consumer_totals(pipelined ? consumers : 0, totals);
+  // Continue from the iterations cached by earlier runs. Importance sampled, approximate, and bootstrap
+  // results aren't cached.
+  const bool cache_results = ctx.use_result_cache && shard_ct == 1 && !acc.importance_sampled && !approximate
+                             && ctx.bootstrap_pool == nullptr;
+  const int cached = cache_results ? load_cached_iterations(ctx, n, iters, &acc) : 0;
+  progress.add(cached, 0, 0);
+  if (pipelined) {
+    // Every thread farms or searches with its own copy of the configs
+    std::vector<RunContext> producer_ctxs(producers, ctx), consumer_ctxs(consumers, ctx);
+    run_pipeline(begin + cached, end, producers, consumers,
+                 [&](int producer, int iter, FarmWorkspace* workspace) {
+                   set_crit_tilt(ctx.crit_tilt);
+                   farm_iteration_candidates(producer_ctxs[producer], n, iter, workspace);
+                 },
+                 [&](int consumer, FarmWorkspace& workspace) {
+                   RunContext& consumer_ctx = consumer_ctxs[consumer];
+                   set_optimizer_gap(gap, max_sets);
+                   const FarmedSet max_set = optimize_candidates(consumer_ctx.character, consumer_ctx.weapon, workspace);
+                   consumer_totals[consumer].add(consumer_ctx.character, workspace.iter, max_set);
+                   progress.add(1, n, max_set.leaf_sets);
+                 },
+                 [&progress] { return progress.is_cancelled(); });
+    for (const FarmTotals& consumer_total : consumer_totals)
+      totals.merge(consumer_total);
+  } else {
+    set_crit_tilt(ctx.crit_tilt);
+    set_optimizer_gap(gap, max_sets);
+    for (int i = begin + cached; i < end && !progress.is_cancelled(); i++) {
+      const FarmedSet max_set = farm_iteration(ctx, n, i);
+      totals.add(ctx.character, i, max_set);
+      progress.add(1, n, max_set.leaf_sets);
+    }
+    set_optimizer_gap(0.0, 0);
+    set_crit_tilt(1.0);
+  }
+  // Cancelled pipelines may leave gaps in the iterations done, which can't be cached
+  if (cache_results && acc.count > cached && !(pipelined && progress.is_cancelled())) {
+    store_cached_iterations(ctx, n, acc);
+  }
+
+  std::lock_guard<std::mutex> lock(job_output_mutex());
+  print_time(start);
+  if (cached > 0) std::cerr << "Reused " << cached << " cached iterations." << std::endl;
+  if (progress.is_cancelled()) {
+    std::cerr << "Cancelled after " << acc.count << " of " << end - begin << " iterations." << std::endl;
+    if (acc.count == 0) {
+      std::cerr << std::endl;
+      return;
+    }
+    // A partial shard can't be merged, so print its statistics instead
+    print_statistics(analyze_farmed_set(acc));
+  } else if (shard_ct > 1) {
+    ShardResult result = {"farm", ctx.character_name, ctx.weapon_name, ctx.master_seed, ctx.generator,
+                          iters, shard, shard_ct, {n}, {acc}};
+    write_shard(result);
+  } else {
+    const FarmedSetStats stats = analyze_farmed_set(acc);
+    print_statistics(stats);
+    if (!totals.replicate_accs.empty()) print_bootstrap_errors(ctx.bootstrap, n, stats, totals.replicate_accs);
+  }
+  if (approximate && acc.count > 0) {
+    std::cerr << "Certified optimality gap: mean " << 100 * totals.gap_total / acc.count << "%, max "
+              << 100 * totals.gap_max << "%" << std::endl << std::endl;
+  }
+}
+
+// A batch of the iterations [begin, end) of one value of n of a farm_script sweep. The worker
+// running it fills acc and then sets finished, after which only the thread merging the results
+// reads it, so no accumulator is ever shared between threads.
+struct SweepBatch {
+  int idx;
+  int begin;
+  int end;
+  FarmedSetAccumulator acc;
+  double seconds;
+  std::atomic<bool> finished;
+
+  SweepBatch(int n_idx, int first, int last) : idx(n_idx), begin(first), end(last), seconds(0.0), finished(false) {}
+};
+
+// Seconds per farm iteration as a function of n, a * n^b
+struct IterationCost {
+  double a;
+  double b;
+
+  double seconds(int n) const { return a * std::pow((double) n, b); }
+};
+
+// Least squares fit of log(seconds per iteration) = log(a) + b * log(n) to the timed batches.
+IterationCost fit_iteration_cost(const std::deque<SweepBatch>& batches, const std::vector<int>& n_values) {
+  double sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+  int points = 0;
+  for (const SweepBatch& batch : batches) {
+    if (batch.acc.count == 0 || batch.seconds <= 0.0) continue;
+    const double x = std::log((double) std::max(1, n_values[batch.idx]));
+    const double y = std::log(batch.seconds / batch.acc.count);
+    sum_x += x;
+    sum_y += y;
+    sum_xx += x * x;
+    sum_xy += x * y;
+    points++;
+  }
+  // Without timings only the order of the costs matters, which a linear cost gets right
+  if (points == 0) return {1.0, 1.0};
+  const double mean_x = sum_x / points, mean_y = sum_y / points;
+  const double variance = sum_xx / points - mean_x * mean_x;
+  const double b = (variance > 1e-9) ? (sum_xy / points - mean_x * mean_y) / variance : 1.0;
+  return {std::exp(mean_y - b * mean_x), b};
+}
+
+// Runs or continues a farm_script run from its checkpoint on the given number of threads,
+// stopping early if cancelled. A cancelled run can be resumed from its checkpoint.
+//
+// The sweep is split into batches of iterations of one n, run by a work stealing scheduler.
+// The first COST_PROBE_ITERATIONS of every n are timed to fit the cost of an iteration as a
+// function of n, which then sizes the remaining batches to about the same cost and orders them
+// longest first. Each batch accumulates on its own, and finished batches are merged in order of
+// their iterations, so the results are the same as running the iterations one after another.
+void run_farm_script(RunContext& ctx, ScriptCheckpoint checkpoint, const std::string& checkpoint_name, int threads,
+                     JobProgress& progress) {
+  ShardResult& result = checkpoint.result;
+  std::ofstream output_file;
+  if (result.shard_ct == 1) {
+    output_file.open("output.csv");
+    if (!output_file.is_open()) {
+      std::cerr << "Error: failed to open output file for writing." << std::endl;
+      return;
+    }
+    output_file << STATS_CSV_HEADER << std::endl;
+  }
+
+  if (!prepare_drop_cache(ctx, checkpoint.stop_n, result.iters)) return;
+  BootstrapPool pool;
+  prepare_bootstrap_pool(ctx, threads, &pool);
+
+  int begin = 0, end = 0;
+  shard_iterations(result.iters, result.shard, result.shard_ct, &begin, &end);
+  const bool cache_results = ctx.use_result_cache && result.shard_ct == 1 && ctx.bootstrap_pool == nullptr;
+  // Start the values of n the checkpoint doesn't have yet, from their cached results if there are any
+  for (int n = checkpoint.start_n + (int) result.n.size() * checkpoint.step; n <= checkpoint.stop_n;
+       n += checkpoint.step) {
+    result.n.push_back(n);
+    result.accumulators.push_back(FarmedSetAccumulator());
+    progress.add(cache_results ? load_cached_iterations(ctx, n, end, &result.accumulators.back()) : 0, 0, 0);
+  }
+  const int n_ct = (int) result.n.size();
+
+  WorkStealingScheduler scheduler(threads);
+  // Each worker farms with its own copy of the configs
+  std::vector<RunContext> contexts(scheduler.size(), ctx);
+  std::deque<SweepBatch> batches;
+  // Batches of every n in order of their iterations, and the first iteration not in a batch yet
+  std::vector<std::vector<SweepBatch*>> batches_by_n(n_ct);
+  std::vector<int> scheduled(n_ct);
+  std::vector<unsigned int> merged(n_ct, 0);
+  std::vector<int64_t> stored(n_ct);
+  int64_t iterations_left = 0;
+  for (int idx = 0; idx < n_ct; idx++) {
+    scheduled[idx] = begin + (int) result.accumulators[idx].count;
+    stored[idx] = result.accumulators[idx].count;
+    iterations_left += end - scheduled[idx];
+  }
+  std::cerr << "Farming " << iterations_left << " iterations for " << n_ct << " values of n on "
+            << scheduler.size() << (scheduler.size() == 1 ? " thread..." : " threads...") << std::endl;
+
+  auto add_batch = [&](int idx, int iterations) {
+    batches.emplace_back(idx, scheduled[idx], scheduled[idx] + iterations);
+    batches_by_n[idx].push_back(&batches.back());
+    scheduled[idx] += iterations;
+    return &batches.back();
+  };
+  auto batch_task = [&contexts, &progress, &result](SweepBatch* batch) -> WorkStealingScheduler::Task {
+    const int n = result.n[batch->idx];
+    return [batch, n, &contexts, &progress](int worker) {
+      RunContext& worker_ctx = contexts[worker];
+      auto start = std::chrono::steady_clock::now();
+      for (int i = batch->begin; i < batch->end && !progress.is_cancelled(); i++) {
+        const FarmedSet max_set = farm_iteration(worker_ctx, n, i);
+        batch->acc.add(worker_ctx.character, max_set);
+        progress.add(1, n, max_set.leaf_sets);
+      }
+      batch->seconds = std::chrono::duration_cast<std::chrono::duration<double>>(
+          std::chrono::steady_clock::now() - start).count();
+      batch->finished.store(true, std::memory_order_release);
+    };
+  };
+
+  // Merges the finished batches that continue the iterations of each accumulator, writes the rows
+  // of the values of n finished in order, caches finished results, and saves a checkpoint every
+  // CHECKPOINT_SECONDS. Only ever runs on this thread.
+  int rows_written = 0;
+  auto last_checkpoint = std::chrono::steady_clock::now();
+  auto merge_finished = [&]() {
+    for (int idx = 0; idx < n_ct; idx++) {
+      FarmedSetAccumulator& acc = result.accumulators[idx];
+      while (merged[idx] < batches_by_n[idx].size()
+             && batches_by_n[idx][merged[idx]]->finished.load(std::memory_order_acquire)) {
+        // A batch that was cancelled partway leaves a gap no later batch can be merged across
+        const SweepBatch* batch = batches_by_n[idx][merged[idx]];
+        if (batch->begin != begin + acc.count) break;
+        acc.merge(batch->acc);
+        merged[idx]++;
+      }
+      if (cache_results && acc.count == end - begin && stored[idx] < acc.count) {
+        store_cached_iterations(ctx, result.n[idx], acc);
+        stored[idx] = acc.count;
+      }
+    }
+    for (; rows_written < n_ct && result.accumulators[rows_written].count == end - begin; rows_written++) {
+      if (result.shard_ct == 1) {
+        write_stats_row(output_file, result.n[rows_written], analyze_farmed_set(result.accumulators[rows_written]));
+      }
+    }
+    if (std::chrono::steady_clock::now() - last_checkpoint > std::chrono::seconds(CHECKPOINT_SECONDS)) {
+      save_checkpoint(checkpoint_name, checkpoint);
+      last_checkpoint = std::chrono::steady_clock::now();
+    }
+  };
+
+  // Time the first iterations of every n, largest n first as those are likely the slowest
+  std::vector<WorkStealingScheduler::Task> tasks;
+  for (int idx = n_ct - 1; idx >= 0; idx--) {
+    if (scheduled[idx] < end) tasks.push_back(batch_task(add_batch(idx, std::min(COST_PROBE_ITERATIONS, end - scheduled[idx]))));
+  }
+  scheduler.run(tasks, merge_finished, std::chrono::milliseconds(SWEEP_POLL_MILLISECONDS));
+  merge_finished();
+
+  // Split the rest into batches of about the same cost, enough for every worker to get
+  // SWEEP_BATCHES_PER_WORKER of them, and run the longest ones first
+  if (!progress.is_cancelled()) {
+    const IterationCost cost = fit_iteration_cost(batches, result.n);
+    double total_seconds = 0.0;
+    for (int idx = 0; idx < n_ct; idx++)
+      total_seconds += (end - scheduled[idx]) * cost.seconds(result.n[idx]);
+    const double batch_seconds = total_seconds / (scheduler.size() * SWEEP_BATCHES_PER_WORKER);
+    std::vector<SweepBatch*> sized;
+    for (int idx = 0; idx < n_ct; idx++) {
+      const int left = end - scheduled[idx];
+      if (left == 0) continue;
+      const double batch_iterations = batch_seconds / cost.seconds(result.n[idx]);
+      const int batch_ct = (batch_iterations >= left) ? 1 : std::min(left, (int) std::ceil(left / batch_iterations));
+      // Spread the iterations evenly over the batches
+      for (int b = 0; b < batch_ct; b++)
+        sized.push_back(add_batch(idx, left / batch_ct + (b < left % batch_ct ? 1 : 0)));
+    }
+    std::stable_sort(sized.begin(), sized.end(), [&cost, &result](const SweepBatch* x, const SweepBatch* y) {
+      return (x->end - x->begin) * cost.seconds(result.n[x->idx]) > (y->end - y->begin) * cost.seconds(result.n[y->idx]);
+    });
+    tasks.clear();
+    for (SweepBatch* batch : sized)
+      tasks.push_back(batch_task(batch));
+    scheduler.run(tasks, merge_finished, std::chrono::milliseconds(SWEEP_POLL_MILLISECONDS));
+    merge_finished();
+  }
+
+  if (progress.is_cancelled()) {
+    save_checkpoint(checkpoint_name, checkpoint);
+    int64_t done = 0;
+    for (int idx = 0; idx < n_ct; idx++) {
+      FarmedSetAccumulator& acc = result.accumulators[idx];
+      if (cache_results && stored[idx] < acc.count) store_cached_iterations(ctx, result.n[idx], acc);
+      done += acc.count;
+    }
+    std::lock_guard<std::mutex> lock(job_output_mutex());
+    std::cerr << "Cancelled after " << done << " of " << (int64_t) n_ct * (end - begin) << " iterations." << std::endl;
+    std::cerr << "Finished rows are in output.csv. Continue with farm_script --resume." << std::endl << std::endl;
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(job_output_mutex());
+  if (result.shard_ct > 1) write_shard(result);
+  // The run is complete, so the checkpoint is no longer needed
+  std::remove(checkpoint_name.c_str());
+  std::cerr << "Done." << std::endl;
+  std::cerr << std::endl;
+}
+
+// Simulates iters people farming until their best set reaches target damage, giving up after max_n
+// artifacts, and prints how many artifacts and how much resin they needed. Stops early if cancelled.
+void run_farm_to(RunContext& ctx, int iters, int target, int max_n, JobProgress& progress) {
+  auto start = std::chrono::steady_clock::now();
+
+  // Artifacts needed by the people that reached the target
+  std::vector<int> needed;
+  int done = 0;
+  for (int i = 0; i < iters && !progress.is_cancelled(); i++) {
+    int farmed = 0;
+    const FarmedSet max_set = farm_to(ctx.character, ctx.weapon, target, max_n, ctx.master_seed, i, &farmed);
+    if (max_set.damage >= target && max_set.damage > 0) needed.push_back(farmed);
+    done++;
+    progress.add(1, farmed, max_set.leaf_sets);
+  }
+
+  std::lock_guard<std::mutex> lock(job_output_mutex());
+  print_time(start);
+  if (progress.is_cancelled()) std::cerr << "Cancelled after " << done << " of " << iters << " iterations." << std::endl;
+  if (done == 0) {
+    std::cerr << std::endl;
+    return;
+  }
+
+  std::sort(needed.begin(), needed.end());
+  const int reached = (int) needed.size();
+  std::cerr << "Reached " << target << " damage within " << max_n << " artifacts: " << reached << " of " << done
+            << " people (" << print_percentage(reached, done) << "%)" << std::endl;
+  if (reached == 0) {
+    std::cerr << std::endl;
+    return;
+  }
+  // People that didn't reach the target count as needing more than max_n artifacts
+  auto print_distribution = [&](const std::string& label, double scale) {
+    double total = 0;
+    for (int x : needed)
+      total += x;
+    std::cerr << label << " needed: mean " << round(total * scale / reached) << " (of those reaching the target)";
+    for (int p : {5, 25, 50, 75, 95}) {
+      const int idx = std::max(0, (int) std::ceil(p / 100.0 * done) - 1);
+      std::cerr << " | " << p << "%ile: ";
+      if (idx < reached) {
+        std::cerr << round(needed[idx] * scale);
+      } else {
+        std::cerr << ">" << round(max_n * scale);
+      }
+    }
+    std::cerr << std::endl;
+  };
+  print_distribution("Artifacts", 1);
+  print_distribution("Resin", 100.0 * RESIN_PER_RUN / ARTIFACTS_PER_RUN_X100);
+  std::cerr << std::endl;
+}
+
+// Rolls iters artifacts on the given number of threads, or one per core if threads <= 0, stopping
+// early if cancelled. Block b of the artifacts is rolled with the random substream b of roll_seed,
+// so the statistics don't depend on the number of threads.
+void run_roll(FarmingConfig fcfg, int64_t iters, uint64_t roll_seed, int threads, JobProgress& progress) {
+  // Artifacts per block. Progress is reported in blocks, since rolling one artifact is cheap
+  constexpr int ROLL_BLOCK = 4096;
+  auto start = std::chrono::steady_clock::now();
+
+  // Every worker adds the artifacts it rolls to its own accumulator, claiming blocks until none are left
+  WorkStealingScheduler scheduler(threads);
+  std::vector<RollAccumulator> accs(scheduler.size());
+  const int64_t blocks = (iters + ROLL_BLOCK - 1) / ROLL_BLOCK;
+  std::atomic<int64_t> next_block(0);
+  std::vector<WorkStealingScheduler::Task> tasks;
+  for (int w = 0; w < scheduler.size(); w++) {
+    tasks.push_back([&](int worker) {
+      FarmingConfig worker_fcfg = fcfg;
+      for (int64_t b = next_block++; b < blocks && !progress.is_cancelled(); b = next_block++) {
+        seed(iteration_seed(roll_seed, b));
+        worker_fcfg.domain_idx = 0;
+        const int block_size = (int) std::min<int64_t>(ROLL_BLOCK, iters - b * ROLL_BLOCK);
+        for (int i = 0; i < block_size; i++) {
+          Artifact a;
+          gen_random(&a, worker_fcfg);
+          upgrade_full(&a);
+          accs[worker].add(worker_fcfg, a);
+        }
+        progress.add(block_size, block_size, 0);
+      }
+    });
+  }
+  scheduler.run(tasks);
+  RollAccumulator acc;
+  for (const RollAccumulator& worker_acc : accs)
+    acc.merge(worker_acc);
+
+  std::lock_guard<std::mutex> lock(job_output_mutex());
+  print_time(start);
+  if (progress.is_cancelled()) {
+    std::cerr << "Cancelled after rolling " << acc.count << " of " << iters << " artifacts." << std::endl;
+  }
+  if (acc.count > 0) print_statistics(acc);
+}
+
+// Characters and weapons compared by the matrix command. characters[c * weapon_names.size() + w]
+// is the c-th character set up for the w-th weapon, which matters for derived stat weights.
+struct LoadoutMatrix {
+  std::vector<std::string> character_names;
+  std::vector<std::string> weapon_names;
+  std::vector<Character> characters;
+  std::vector<Weapon> weapons;
+};
+
+// Load every config in config/characters and config/weapons. Configs that fail to load are skipped.
+LoadoutMatrix load_loadout_matrix() {
+  LoadoutMatrix matrix;
+  std::vector<Character> base_characters;
+  for (const std::string& name : list_configs("characters")) {
+    Character c = {};
+    if (read_character_config(name, &c)) {
+      matrix.character_names.push_back(name);
+      base_characters.push_back(c);
+    } else {
+      std::cerr << "Skipping invalid character config " << name << std::endl;
+    }
+  }
+  for (const std::string& name : list_configs("weapons")) {
+    Weapon w = {};
+    if (read_weapon_config(name, &w)) {
+      matrix.weapon_names.push_back(name);
+      matrix.weapons.push_back(w);
+    } else {
+      std::cerr << "Skipping invalid weapon config " << name << std::endl;
+    }
+  }
+  for (const Character& base : base_characters) {
+    for (Weapon& w : matrix.weapons) {
+      Character c = base;
+      if (c.farming_config.derive_stat_score) apply_derived_stat_weights(c, w);
+      matrix.characters.push_back(c);
+    }
+  }
+  return matrix;
+}
+
+// Simulates iters people farming n artifacts each, and optimizes every character and weapon pair
+// on each person's drops. Every domain stream of a person is generated once, from the iteration's
+// seed, and shared by all pairs farming that domain, so that pairs only differ by their loadout.
+// Prints the mean damage of every pair, and each weapon's paired difference to the best one for
+// the character. Stops early if cancelled.
+void run_matrix(RunContext& ctx, LoadoutMatrix matrix, int iters, int n, JobProgress& progress) {
+  auto start = std::chrono::steady_clock::now();
+  const int weapon_ct = (int) matrix.weapons.size();
+  const int pair_ct = (int) matrix.characters.size();
+
+  // Generate as many drops of each domain as the character farming it most needs
+  int64_t counts[DOMAIN_CT] = {};
+  for (const Character& c : matrix.characters) {
+    int64_t character_counts[DOMAIN_CT];
+    drops_per_iteration(c.farming_config.domains, n, character_counts);
+    for (int i = 0; i < DOMAIN_CT; i++)
+      counts[i] = std::max(counts[i], character_counts[i]);
+  }
+  std::vector<Artifact> streams[DOMAIN_CT];
+  DropCache pool = {};
+  for (int i = 0; i < DOMAIN_CT; i++) {
+    streams[i].resize(2 * counts[i]);
+    pool.streams[i].drops = streams[i].data();
+    pool.streams[i].size = counts[i];
+  }
+
+  // damages[p][i] is the damage pair p reached on the i-th person's drops
+  std::vector<std::vector<int>> damages(pair_ct);
+  int done = 0;
+  for (int i = 0; i < iters && !progress.is_cancelled(); i++) {
+    const uint64_t pool_seed = iteration_seed(ctx.master_seed, i);
+    for (int d = 0; d < DOMAIN_CT; d++) {
+      if (counts[d] == 0) continue;
+      seed(iteration_seed(pool_seed, d));
+      gen_drops(static_cast<Domain>(d), counts[d], streams[d].data());
+    }
+    int64_t leaf_sets = 0;
+    for (int p = 0; p < pair_ct; p++) {
+      const FarmedSet max_set = farm(matrix.characters[p], matrix.weapons[p % weapon_ct], n, pool, 0);
+      damages[p].push_back(max_set.damage);
+      leaf_sets += max_set.leaf_sets;
+    }
+    done++;
+    progress.add(1, n, leaf_sets);
+  }
+
+  std::lock_guard<std::mutex> lock(job_output_mutex());
+  print_time(start);
+  if (progress.is_cancelled()) std::cerr << "Cancelled after " << done << " of " << iters << " iterations." << std::endl;
+  if (done == 0) {
+    std::cerr << std::endl;
+    return;
+  }
+
+  // Mean and standard error of the mean of values[i] - baseline[i], or of values if baseline is null
+  auto mean_and_se = [done](const std::vector<int>& values, const std::vector<int>* baseline, double* mean, double* se) {
+    double sum = 0, sum_sq = 0;
+    for (int i = 0; i < done; i++) {
+      const double x = values[i] - (baseline ? (*baseline)[i] : 0);
+      sum += x;
+      sum_sq += x * x;
+    }
+    *mean = sum / done;
+    const double variance = (done > 1) ? std::max(0.0, (sum_sq - sum * *mean) / (done - 1)) : 0;
+    *se = std::sqrt(variance / done);
+  };
+
+  std::cerr << "Mean damage +- standard error of " << done << " people farming " << n << " artifacts,\n"
+            << "and the paired difference to the best weapon on the same artifacts:" << std::endl;
+  for (unsigned int c = 0; c < matrix.character_names.size(); c++) {
+    std::vector<double> means(weapon_ct), ses(weapon_ct);
+    int best = 0;
+    for (int w = 0; w < weapon_ct; w++) {
+      mean_and_se(damages[c * weapon_ct + w], nullptr, &means[w], &ses[w]);
+      if (means[w] > means[best]) best = w;
+    }
+    std::cerr << matrix.character_names[c] << std::endl;
+    for (int w = 0; w < weapon_ct; w++) {
+      std::cerr << "  " << matrix.weapon_names[w] << ": " << round(means[w]) << " +- " << round(10 * ses[w]) / 10;
+      if (w == best) {
+        std::cerr << " | best" << std::endl;
+        continue;
+      }
+      double diff, diff_se;
+      mean_and_se(damages[c * weapon_ct + w], &damages[c * weapon_ct + best], &diff, &diff_se);
+      std::cerr << " | " << round(10 * diff) / 10 << " +- " << round(10 * diff_se) / 10
+                << " (" << round(1000 * diff / means[best]) / 10 << "%)" << std::endl;
+    }
+  }
+  std::cerr << std::endl;
+}
+
+// Runs work in the foreground, or as a background job with its own copy of the context and
+// its own mapping of the artifact cache.
+void run_command(const std::vector<std::string>& input_list, bool background, int64_t total_iterations,
+                 std::function<void(RunContext&, JobProgress&)> work) {
+  RunContext ctx = current_context();
+  if (!background) {
+    JobProgress progress(total_iterations);
+    work(ctx, progress);
+    return;
+  }
+
+  std::string command;
+  for (const std::string& arg : input_list)
+    command += (command.empty() ? "" : " ") + arg;
+  const uint64_t drop_cache_seed = drop_cache.seed;
+  const int id = start_job(command, total_iterations, [ctx, drop_cache_seed, work](JobProgress& progress) {
+    RunContext job_ctx = ctx;
+    DropCache job_cache = {};
+    job_cache.seed = drop_cache_seed;
+    job_ctx.drop_cache = &job_cache;
+    work(job_ctx, progress);
+    close_drop_cache(&job_cache);
+  });
+  std::cerr << "Started job " << id << ": " << command << std::endl << std::endl;
+}
+
 }  // namespace
 
 int main(/*int argc, char** argv*/) {
@@ -50,33 +930,103 @@ int main(/*int argc, char** argv*/) {
   while (getline(std::cin, input)) {
     std::vector<std::string> input_list = split(input, ' ');
     if (input_list.size() <= 0) continue;
+    // A trailing & runs farm, farm_script, farm_to, matrix, and roll as background jobs
+    const bool background = input_list.size() > 1 && input_list.back() == "&";
+    if (background) input_list.pop_back();
 
     if (input_list[0] == "farm") {
       int iters = std::stoi(input_list[1]);
       int artifacts_to_farm = std::stoi(input_list[2]);
+      int shard = 0, shard_ct = 1;
+      if (!parse_shard(input_list, &shard, &shard_ct)) continue;
+      if (crit_tilt != 1.0 && (shard_ct > 1 || use_drop_cache || generator != GENERATOR_SCALAR
+                               || bootstrap_settings.drops > 0)) {
+        std::cerr << "Importance sampling only works with the scalar generator, without the artifact cache,"
+                  << " bootstrap pool, or shards." << std::endl << std::endl;
+        continue;
+      }
+      if (!valid_bootstrap_run(artifacts_to_farm, shard_ct)) continue;
+      double gap = 0.0;
+      int64_t max_sets = 0;
+      if (!parse_approx(input_list, &gap, &max_sets)) continue;
+      // Shard files don't record the gap, so approximate shards could be merged with exact ones
+      if ((gap > 0 || max_sets > 0) && shard_ct > 1) {
+        std::cerr << "The approximate optimizer doesn't work with shards." << std::endl << std::endl;
+        continue;
+      }
+      int producers = 0, consumers = 0;
+      if (!parse_pipeline(input_list, &producers, &consumers)) continue;
 
-      auto start = std::chrono::high_resolution_clock::now();
+      run_command(input_list, background, iters,
+                  [iters, artifacts_to_farm, shard, shard_ct, gap, max_sets, producers, consumers](
+                      RunContext& ctx, JobProgress& progress) {
+        run_farm(ctx, iters, artifacts_to_farm, shard, shard_ct, gap, max_sets, producers, consumers, progress);
+      });
+      continue;
+    }
 
-      std::vector<FarmedSet> all_max_sets;
-      for (int i = 0; i < iters; i++) {
-        all_max_sets.push_back(farm(character, weapon, artifacts_to_farm));
+    if (input_list[0] == "farm_to") {
+      if (input_list.size() < 4) {
+        std::cerr << "Not enough arguments given." << std::endl << std::endl;
+        continue;
       }
+      const int iters = std::stoi(input_list[1]);
+      const int target = std::stoi(input_list[2]);
+      const int max_n = std::stoi(input_list[3]);
 
-      auto end = std::chrono::high_resolution_clock::now();
-      std::cerr << "Time: "
-                << std::chrono::duration_cast<std::chrono::duration<double>>(end-start).count()
-                << "s" << std::endl;
+      run_command(input_list, background, iters, [iters, target, max_n](RunContext& ctx, JobProgress& progress) {
+        run_farm_to(ctx, iters, target, max_n, progress);
+      });
+      continue;
+    }
 
-      print_statistics(character, all_max_sets);
+    if (input_list[0] == "matrix") {
+      if (input_list.size() < 3) {
+        std::cerr << "Not enough arguments given." << std::endl << std::endl;
+        continue;
+      }
+      const int iters = std::stoi(input_list[1]);
+      const int artifacts_to_farm = std::stoi(input_list[2]);
+      LoadoutMatrix matrix = load_loadout_matrix();
+      if (matrix.characters.empty()) {
+        std::cerr << "No character and weapon configs found." << std::endl << std::endl;
+        continue;
+      }
+
+      run_command(input_list, background, iters,
+                  [matrix, iters, artifacts_to_farm](RunContext& ctx, JobProgress& progress) {
+        run_matrix(ctx, matrix, iters, artifacts_to_farm, progress);
+      });
       continue;
     }
 
     if (input_list[0] == "farm_one") {
       int artifacts_to_farm = std::stoi(input_list[1]);
+      const bool threads_given = std::find(input_list.begin(), input_list.end(), "--threads") != input_list.end();
+      // Only the search for the single best set runs on several threads
+      const int k = (input_list.size() > 2 && input_list[2] != "--threads") ? std::stoi(input_list[2])
+                  : (threads_given || artifacts_to_farm > FARM_ONE_TOP_K_MAX_N) ? 1 : FARM_ONE_TOP_K;
+      if (k < 1) {
+        std::cerr << "Invalid number of sets given." << std::endl << std::endl;
+        continue;
+      }
+      if (k > 1 && threads_given) {
+        std::cerr << "--threads needs k = 1, the k best sets are searched on one thread." << std::endl << std::endl;
+        continue;
+      }
+      // One thread per core unless given
+      int threads = 0;
+      if (!parse_threads(input_list, &threads)) continue;
+      RunContext ctx = current_context();
+      if (!prepare_drop_cache(ctx, artifacts_to_farm, 1)) continue;
 
       auto start = std::chrono::high_resolution_clock::now();
 
-      FarmedSet max_set = farm(character, weapon, artifacts_to_farm);
+      std::vector<FarmedSet> top_sets;
+      set_search_threads(threads);
+      FarmedSet max_set = use_drop_cache ? farm(character, weapon, artifacts_to_farm, drop_cache, 0, k, &top_sets)
+                                         : farm(character, weapon, artifacts_to_farm, k, &top_sets);
+      set_search_threads(1);
 
       auto end = std::chrono::high_resolution_clock::now();
       std::cerr << "Time: "
@@ -96,67 +1046,347 @@ int main(/*int argc, char** argv*/) {
       }
       std::cerr << std::endl;
       std::cerr << "Damage achieved: " << max_set.damage << std::endl;
+      // How close the next best sets come, and which pieces they swap out
+      for (unsigned int i = 1; i < top_sets.size(); i++) {
+        std::cerr << "#" << i + 1 << ": " << top_sets[i].damage << " ("
+                  << print_percentage(top_sets[i].damage - max_set.damage, max_set.damage) << "%) | Swaps:";
+        for (int j = 0; j < SLOT_CT; j++) {
+          const Artifact& a = top_sets[i].artifacts[j];
+          const Artifact& best = max_set.artifacts[j];
+          if (a.stat_score != best.stat_score || a.mainstat != best.mainstat || a.set != best.set
+              || !std::equal(a.substat_values, a.substat_values + SUBSTAT_CT, best.substat_values)) {
+            std::cerr << " " << print_slot(static_cast<Slot>(j));
+          }
+        }
+        std::cerr << std::endl;
+      }
       std::cerr << std::endl;
       continue;
     }
 
     if (input_list[0] == "farm_script") {
-      int iters = std::stoi(input_list[1]);
-      int start_n = std::stoi(input_list[2]);
-      int stop_n = std::stoi(input_list[3]);
-      int step = std::stoi(input_list[4]);
+      // Runs in the foreground or background would write the same output.csv and checkpoint.
+      // Checked first, since --resume changes the seed and drop settings.
+      if (job_running("farm_script")) {
+        std::cerr << "A farm_script job is already running, wait for it or cancel it first." << std::endl << std::endl;
+        continue;
+      }
+      const bool resume = std::find(input_list.begin(), input_list.end(), "--resume") != input_list.end();
+      int shard = 0, shard_ct = 1;
+      if (!parse_shard(input_list, &shard, &shard_ct)) continue;
+      // One thread per core unless given
+      int threads = 0;
+      if (!parse_threads(input_list, &threads)) continue;
+      const std::string checkpoint_name = (shard_ct > 1)
+          ? "farm_script_shard_" + std::to_string(shard) + "_of_" + std::to_string(shard_ct) + ".ckpt"
+          : "farm_script.ckpt";
 
-      std::ofstream output_file("output.csv");
-      if (!output_file.is_open()) {
-        std::cerr << "Error: failed to open output file for writing." << std::endl;
+      ScriptCheckpoint checkpoint = {};
+      ShardResult& result = checkpoint.result;
+      if (input_list.size() > 4 && input_list[1] != "--resume" && input_list[1] != "--shard"
+          && input_list[1] != "--threads") {
+        result = {"farm_script", main_config.character, main_config.weapon, master_seed, generator,
+                  std::stoi(input_list[1]), shard, shard_ct, {}, {}};
+        checkpoint.start_n = std::stoi(input_list[2]);
+        checkpoint.stop_n = std::stoi(input_list[3]);
+        checkpoint.step = std::stoi(input_list[4]);
+        checkpoint.use_drop_cache = use_drop_cache;
+        checkpoint.drop_cache_seed = drop_cache.seed;
+        checkpoint.bootstrap = bootstrap_settings;
+      } else if (!resume) {
+        std::cerr << "Not enough arguments given." << std::endl << std::endl;
         continue;
       }
-      output_file << "Artifacts,Mean,Stddev,5%ile,25%ile,Median,75%ile,95%ile,Good Rolls,Avg(2*CR + CD),Upgrade ratio" << std::endl;
 
-      for (int n = start_n; n <= stop_n; n += step) {
-        std::cerr << "Farming " << n << " artifacts " << iters << " times..." << std::endl;
-        std::vector<FarmedSet> all_max_sets;
-        for (int i = 0; i < iters; i++) {
-          all_max_sets.push_back(farm(character, weapon, n));
+      if (resume) {
+        ScriptCheckpoint saved;
+        if (!read_checkpoint(checkpoint_name, &saved)) {
+          std::cerr << "Error reading checkpoint " << checkpoint_name << std::endl << std::endl;
+          continue;
+        }
+        if (saved.result.character != main_config.character || saved.result.weapon != main_config.weapon) {
+          std::cerr << "Checkpoint is for " << saved.result.character << " with " << saved.result.weapon
+                    << ", set those configs before resuming." << std::endl << std::endl;
+          continue;
         }
+        // Arguments given with --resume must match the interrupted run, apart from the seed, generator, cache,
+        // and bootstrap pool
+        if (!result.command.empty()
+            && (result.iters != saved.result.iters || checkpoint.start_n != saved.start_n
+                || checkpoint.stop_n != saved.stop_n || checkpoint.step != saved.step)) {
+          std::cerr << "Checkpoint is for a different farm_script run." << std::endl << std::endl;
+          continue;
+        }
+        checkpoint = saved;
+        // Continue with the seed, generator, artifact cache, and bootstrap pool of the interrupted run
+        master_seed = result.seed;
+        generator = result.generator;
+        bootstrap_settings = checkpoint.bootstrap.drops > 0 ? checkpoint.bootstrap
+                                                             : BootstrapSettings{0, BOOTSTRAP_REPLICATES, false};
+        if (use_drop_cache != checkpoint.use_drop_cache || drop_cache.seed != checkpoint.drop_cache_seed) {
+          close_drop_cache(&drop_cache);
+          use_drop_cache = checkpoint.use_drop_cache;
+          drop_cache.seed = checkpoint.drop_cache_seed;
+        }
+        std::cerr << "Resuming from " << checkpoint_name << std::endl;
+      }
+      if (checkpoint.step <= 0) {
+        std::cerr << "Invalid step given." << std::endl << std::endl;
+        continue;
+      }
+      if (!valid_bootstrap_run(checkpoint.stop_n, shard_ct)) continue;
 
-        FarmedSetStats stats = analyze_farmed_set(character, all_max_sets);
-        output_file << n << ","
-                    << stats.mean << ","
-                    << stats.stddev << ","
-                    << stats.percentiles[5] << ","
-                    << stats.percentiles[25] << ","
-                    << stats.percentiles[50] << ","
-                    << stats.percentiles[75] << ","
-                    << stats.percentiles[95] << ","
-                    << stats.good_rolls << ","
-                    << stats.crit_value << ","
-                    << print_percentage(stats.total_upgrade_ratio[0], stats.total_upgrade_ratio[1]) << "%" << std::endl;
+      int begin = 0, end = 0;
+      shard_iterations(result.iters, shard, shard_ct, &begin, &end);
+      // Iterations left to run, excluding those already done by a resumed run
+      int64_t total_iterations = 0;
+      for (int n = checkpoint.start_n; n <= checkpoint.stop_n; n += checkpoint.step)
+        total_iterations += end - begin;
+      for (const FarmedSetAccumulator& acc : result.accumulators)
+        total_iterations -= acc.count;
+      run_command(input_list, background, total_iterations,
+                  [checkpoint, checkpoint_name, threads](RunContext& ctx, JobProgress& progress) {
+        run_farm_script(ctx, checkpoint, checkpoint_name, threads, progress);
+      });
+      continue;
+    }
+
+    if (input_list[0] == "merge") {
+      if (input_list.size() < 2) {
+        std::cerr << "No shard files given." << std::endl << std::endl;
+        continue;
+      }
+
+      // Combine the accumulators of every shard. This only depends on the number of shards
+      // and the size of their damage histograms, not the number of iterations.
+      ShardResult merged;
+      std::vector<bool> shard_seen;
+      bool valid = true;
+      for (unsigned int i = 1; i < input_list.size() && valid; i++) {
+        ShardResult result;
+        if (!read_shard_result(input_list[i], &result)) {
+          std::cerr << "Error reading shard file " << input_list[i] << std::endl;
+          valid = false;
+        } else if (i == 1) {
+          merged = result;
+          shard_seen.assign(result.shard_ct, false);
+          shard_seen[result.shard] = true;
+        } else if (result.command != merged.command || result.character != merged.character
+                   || result.weapon != merged.weapon || result.seed != merged.seed
+                   || result.generator != merged.generator
+                   || result.iters != merged.iters || result.shard_ct != merged.shard_ct
+                   || result.n != merged.n) {
+          std::cerr << "Shard file " << input_list[i] << " is from a different run." << std::endl;
+          valid = false;
+        } else if (shard_seen[result.shard]) {
+          std::cerr << "Shard " << result.shard << " given more than once." << std::endl;
+          valid = false;
+        } else {
+          shard_seen[result.shard] = true;
+          for (unsigned int j = 0; j < merged.n.size(); j++)
+            merged.accumulators[j].merge(result.accumulators[j]);
+        }
+      }
+      if (!valid) {
+        std::cerr << std::endl;
+        continue;
+      }
+      if (std::find(shard_seen.begin(), shard_seen.end(), false) != shard_seen.end()) {
+        std::cerr << "Warning: not all " << merged.shard_ct << " shards were given." << std::endl;
       }
-      std::cerr << "Done." << std::endl;
-      std::cerr << std::endl;
 
+      std::cerr << "Merged " << merged.command << " results for " << merged.character
+                << " with " << merged.weapon << ", seed " << merged.seed << std::endl;
+      if (merged.command == "farm") {
+        print_statistics(analyze_farmed_set(merged.accumulators[0]));
+      } else {
+        std::ofstream output_file("output.csv");
+        if (!output_file.is_open()) {
+          std::cerr << "Error: failed to open output file for writing." << std::endl;
+          continue;
+        }
+        output_file << STATS_CSV_HEADER << std::endl;
+        for (unsigned int j = 0; j < merged.n.size(); j++)
+          write_stats_row(output_file, merged.n[j], analyze_farmed_set(merged.accumulators[j]));
+        std::cerr << "Results written to output.csv" << std::endl << std::endl;
+      }
       continue;
     }
 
-    if (input_list[0] == "roll") {
+    if (input_list[0] == "policies") {
       int iters = std::stoi(input_list[1]);
+      int artifacts_to_farm = std::stoi(input_list[2]);
+
+      std::vector<UpgradePolicy> policies;
+      if (!read_policy_config(input_list[3], character.farming_config, &policies)) {
+        std::cerr << "Error reading policy config." << std::endl << std::endl;
+        continue;
+      }
 
       auto start = std::chrono::high_resolution_clock::now();
 
-      Artifact* all_artis = get_artifact_storage(iters);
+      std::vector<PolicyResult> results(policies.size());
       for (int i = 0; i < iters; i++) {
-        gen_random(all_artis + i, character.farming_config);
-        upgrade_full(all_artis + i);
+        farm_policies(character, weapon, artifacts_to_farm, policies, &results);
+      }
+
+      auto end = std::chrono::high_resolution_clock::now();
+      std::cerr << "Time: "
+                << std::chrono::duration_cast<std::chrono::duration<double>>(end-start).count()
+                << "s" << std::endl;
+
+      print_statistics(character, policies, results);
+      continue;
+    }
+
+    if (input_list[0] == "tune") {
+      int artifacts_to_farm = std::stoi(input_list[1]);
+      TuneObjective objective = TUNE_MEAN;
+      if (input_list.size() > 2 && input_list[2] == "median") {
+        objective = TUNE_MEDIAN;
+      } else if (input_list.size() > 2 && input_list[2] != "mean") {
+        std::cerr << "Invalid objective given." << std::endl << std::endl;
+        continue;
       }
 
+      auto start = std::chrono::high_resolution_clock::now();
+
+      Character tuned = character;
+      tuned.farming_config = tune(character, weapon, artifacts_to_farm, objective);
+
       auto end = std::chrono::high_resolution_clock::now();
       std::cerr << "Time: "
                 << std::chrono::duration_cast<std::chrono::duration<double>>(end-start).count()
                 << "s" << std::endl;
 
-      print_statistics(all_artis, iters);
-      delete[] all_artis;
+      const std::string tuned_name = main_config.character + "_tuned";
+      if (write_character_config(tuned_name, tuned)) {
+        std::cerr << "Tuned config written to config/characters/" << tuned_name << ".cfg" << std::endl;
+      } else {
+        std::cerr << "Error: failed to write tuned config." << std::endl;
+      }
+      std::cerr << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "roll") {
+      const int64_t iters = std::stoll(input_list[1]);
+      // One thread per core unless given
+      int threads = 0;
+      if (!parse_threads(input_list, &threads)) continue;
+      // The substreams of the roll are seeded from the REPL's RNG
+      const uint64_t roll_seed = gen_seed();
+
+      run_command(input_list, background, iters, [iters, roll_seed, threads](RunContext& ctx, JobProgress& progress) {
+        run_roll(ctx.character.farming_config, iters, roll_seed, threads, progress);
+      });
+      continue;
+    }
+
+    if (input_list[0] == "jobs") {
+      print_jobs();
+      std::cerr << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "status") {
+      if (input_list.size() < 2 || !print_job_status(std::stoi(input_list[1]))) {
+        std::cerr << "No such job." << std::endl;
+      }
+      std::cerr << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "cancel") {
+      if (input_list.size() < 2 || !cancel_job(std::stoi(input_list[1]))) {
+        std::cerr << "No such running job." << std::endl;
+      } else {
+        std::cerr << "Cancelling job " << input_list[1] << ", it will print the results gathered so far." << std::endl;
+      }
+      std::cerr << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "weights") {
+      // Reload the character to get the configured weights even if derive_stat_score replaced them
+      Character configured = {};
+      if (!read_character_config(main_config.character, &configured)) {
+        std::cerr << "Error reading character config." << std::endl << std::endl;
+        continue;
+      }
+      Character derived = configured;
+      apply_derived_stat_weights(derived, weapon);
+      const FarmingConfig& configured_fcfg = configured.farming_config;
+      const FarmingConfig& derived_fcfg = derived.farming_config;
+
+      std::cerr << "Stat weights for " << main_config.character << " with " << main_config.weapon
+                << (configured_fcfg.derive_stat_score ? " (using derived)" : " (using configured)") << ":" << std::endl;
+      std::cerr << "Stat\tConfigured\tDerived" << std::endl;
+      for (int i = 0; i < MAINSTAT_CT; i++) {
+        if (configured_fcfg.stat_score[i] == 0 && derived_fcfg.stat_score[i] == 0) continue;
+        std::cerr << print_stat(static_cast<Stat>(i)) << "\t" << configured_fcfg.stat_score[i]
+                  << "\t\t" << derived_fcfg.stat_score[i] << std::endl;
+      }
+      std::cerr << "Max\t" << configured_fcfg.stat_score_max << "\t\t" << derived_fcfg.stat_score_max << std::endl;
+
+      if (input_list.size() > 2) {
+        const int iters = std::stoi(input_list[1]);
+        const int artifacts_to_farm = std::stoi(input_list[2]);
+        auto start = std::chrono::steady_clock::now();
+        // Both searches run on the same artifacts, leveled by the configured weights
+        const WeightComparison comparison = compare_search_weights(configured, derived, weapon, iters,
+                                                                   artifacts_to_farm, master_seed);
+        std::cerr << std::endl << "Optimizing " << iters << " runs of " << artifacts_to_farm << " artifacts:" << std::endl;
+        std::cerr << "Sets evaluated: " << comparison.leaf_sets[0] << " configured, " << comparison.leaf_sets[1]
+                  << " derived (" << print_percentage(comparison.leaf_sets[0] - comparison.leaf_sets[1],
+                                                      std::max<int64_t>(1, comparison.leaf_sets[0]))
+                  << "% saved)" << std::endl;
+        std::cerr << "Mean damage: " << (double) comparison.damage_total[0] / iters << " configured, "
+                  << (double) comparison.damage_total[1] / iters << " derived" << std::endl;
+        std::cerr << "Derived weights found less damage in " << comparison.lower_damage << " and more in "
+                  << comparison.higher_damage << " of " << iters << " runs." << std::endl;
+        print_time(start);
+      }
+      std::cerr << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "verify") {
+      const int pools = (input_list.size() > 1) ? std::stoi(input_list[1]) : 20;
+      const uint64_t verify_seed = (input_list.size() > 2) ? std::stoull(input_list[2]) : 0;
+      auto start = std::chrono::steady_clock::now();
+
+      // Every character config with the current weapon
+      bool passed = true;
+      for (const std::string& name : list_configs("characters")) {
+        Character c = {};
+        if (!read_character_config(name, &c)) {
+          std::cerr << "Skipping invalid character config " << name << std::endl;
+          continue;
+        }
+        if (c.farming_config.derive_stat_score) apply_derived_stat_weights(c, weapon);
+        const std::vector<VerifyResult> results = verify_optimizer(c, weapon, pools, verify_seed);
+        passed = passed && verification_passed(results);
+
+        std::cerr << name << " with " << main_config.weapon << ":" << std::endl;
+        std::cerr << "Pools\t\tMargin misses\tExact mismatches\tInvalid\tParallel\tApprox\tTies\tSpeedup" << std::endl;
+        for (const VerifyResult& result : results) {
+          std::cerr << result.pool_class << (result.pool_class.size() < 8 ? "\t\t" : "\t")
+                    << result.margin_misses << "/" << result.pools << "\t\t" << result.exact_mismatches
+                    << "\t\t\t" << result.invalid_results << "\t" << result.parallel_mismatches << "\t\t"
+                    << result.approx_violations << "\t" << result.argmax_ties << "\t"
+                    << round(10 * result.reference_seconds / std::max(1e-9, result.seconds)) / 10 << "x" << std::endl;
+          for (const VerifyMismatch& mismatch : result.mismatches) {
+            std::cerr << "  pool " << mismatch.pool << ": " << mismatch.damage << " vs reference "
+                      << mismatch.reference_damage << (mismatch.exact_search ? " (meet in the middle)" : " (nested loops)")
+                      << std::endl;
+          }
+        }
+        std::cerr << std::endl;
+      }
+      print_time(start);
+      std::cerr << (passed ? "Verification passed." : "Verification FAILED: the exact search or a result is wrong.")
+                << std::endl << std::endl;
       continue;
     }
 
@@ -170,8 +1400,95 @@ int main(/*int argc, char** argv*/) {
     }
 
     if (input_list[0] == "seed") {
-      seed();
-      std::cerr << "Random number generator seeded." << std::endl;
+      if (input_list.size() > 1) {
+        master_seed = std::stoull(input_list[1]);
+        seed(master_seed);
+      } else {
+        seed();
+        master_seed = gen_seed();
+      }
+      std::cerr << "Random number generator seeded. Master seed: " << master_seed << std::endl;
+      std::cerr << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "importance") {
+      if (input_list.size() < 2) {
+        std::cerr << "No tilt given." << std::endl << std::endl;
+        continue;
+      }
+      const double tilt = (input_list[1] == "off") ? 1.0 : std::stod(input_list[1]);
+      if (tilt <= 0) {
+        std::cerr << "Invalid tilt given." << std::endl << std::endl;
+        continue;
+      }
+      crit_tilt = tilt;
+      if (crit_tilt == 1.0) {
+        std::cerr << "Importance sampling disabled." << std::endl;
+      } else {
+        std::cerr << "farm upgrades the crit substats of double crit pieces " << crit_tilt << " times as often,"
+                  << " and weights each run by its likelihood ratio." << std::endl;
+      }
+      std::cerr << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "cache") {
+      close_drop_cache(&drop_cache);
+      if (input_list[1] == "off") {
+        use_drop_cache = false;
+        std::cerr << "Artifact cache disabled." << std::endl;
+      } else {
+        drop_cache.seed = std::stoull(input_list[1]);
+        use_drop_cache = true;
+        std::cerr << "Farming from the artifact cache with seed " << drop_cache.seed << "." << std::endl;
+      }
+      std::cerr << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "bootstrap") {
+      if (input_list.size() < 2) {
+        std::cerr << "Expected bootstrap <drops|off> [replicates] [windows]." << std::endl << std::endl;
+        continue;
+      }
+      if (input_list[1] == "off") {
+        bootstrap_settings.drops = 0;
+        std::cerr << "Bootstrap pool disabled." << std::endl << std::endl;
+        continue;
+      }
+      BootstrapSettings settings = {std::atoll(input_list[1].c_str()), BOOTSTRAP_REPLICATES, false};
+      for (unsigned int i = 2; i < input_list.size(); i++) {
+        if (input_list[i] == "windows") {
+          settings.windows = true;
+        } else {
+          settings.replicates = std::atoi(input_list[i].c_str());
+        }
+      }
+      if (settings.drops <= 0 || settings.replicates < 2) {
+        std::cerr << "Invalid bootstrap pool given, expected at least 1 drop and 2 replicates." << std::endl << std::endl;
+        continue;
+      }
+      bootstrap_settings = settings;
+      std::cerr << "farm and farm_script draw " << (settings.windows ? "windows of drops" : "drops with replacement")
+                << " from a pool of " << settings.replicates << " replicates of " << settings.drops << " drops"
+                << (use_drop_cache ? ", instead of the artifact cache." : ".") << std::endl << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "result_cache") {
+      if (input_list.size() < 2 || (input_list[1] != "on" && input_list[1] != "off")) {
+        std::cerr << "Expected result_cache <on|off>." << std::endl << std::endl;
+        continue;
+      }
+      use_result_cache = (input_list[1] == "on");
+      std::cerr << "Result cache " << (use_result_cache ? "enabled." : "disabled.") << std::endl << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "serve") {
+      const int threads = (input_list.size() > 2) ? std::stoi(input_list[2]) : 0;
+      run_server(input_list[1], threads);
       std::cerr << std::endl;
       continue;
     }
@@ -203,27 +1520,137 @@ int main(/*int argc, char** argv*/) {
     if (input_list[0] == "settings") {
       std::cerr << "Current configs used: " << std::endl;
       std::cerr << "Character: " << main_config.character << std::endl;
-      std::cerr << "Weapon: " << main_config.weapon << std::endl << std::endl;
+      std::cerr << "Weapon: " << main_config.weapon << std::endl;
+      std::cerr << "Generator: " << print_generator(generator) << std::endl;
+      std::cerr << "Result cache: " << (use_result_cache ? "on" : "off") << std::endl << std::endl;
+      continue;
+    }
+
+    if (input_list[0] == "generator") {
+      if (input_list.size() < 2 || !read_generator(input_list[1], &generator)) {
+        std::cerr << "Invalid generator given, expected scalar, batch, or candidates." << std::endl << std::endl;
+        continue;
+      }
+      std::cerr << "Using the " << print_generator(generator) << " generator";
+      if (generator == GENERATOR_BATCH) std::cerr << (batch_rng_avx2() ? " (AVX2)" : " (scalar RNG)");
+      std::cerr << "." << std::endl;
+      if (use_drop_cache) std::cerr << "Note: the artifact cache is enabled, and is used instead." << std::endl;
+      std::cerr << std::endl;
       continue;
     }
 
     if (input_list[0] == "help") {
       std::cerr << "Commands:" << std::endl;
-      std::cerr << "farm <iters> <n_artifacts>" << std::endl;
+      std::cerr << "Append & to farm, farm_script, farm_to, matrix, or roll to run it as a background job." << std::endl;
+      std::cerr << "farm <iters> <n_artifacts> [--shard <i>/<N>] [--approx <gap%>] [--budget <sets>]"
+                << " [--pipeline <p>/<c>] [&]" << std::endl;
       std::cerr << "  Simulate <iters> people farming <n_artifacts> artifacts each\n"
-                << "  and print a distribution of damage achieved." << std::endl;
-      std::cerr << "farm_one <n_artifacts>" << std::endl;
-      std::cerr << "  Farm <n_artifacts> artifacts and print the best set of artifacts achieved.\n"
-                << "  For fun or debugging." << std::endl;
-      std::cerr << "farm_script <iters> <start_n> <stop_n> <step>" << std::endl;
+                << "  and print a distribution of damage achieved.\n"
+                << "  With --shard, only run the i-th of N parts of the iterations (0 <= i < N)\n"
+                << "  and write partial results to farm_shard_<i>_of_<N>.txt for merge.\n"
+                << "  With --approx, each set found is within <gap%> of the best set, which is faster to\n"
+                << "  find. With --budget, the search for each set stops after evaluating about <sets> sets.\n"
+                << "  Either way, the mean and max gap that the optimizer could certify is printed.\n"
+                << "  With --pipeline, <p> threads farm the artifacts of the next iterations while <c> threads\n"
+                << "  search the ones farmed for the best set, with the same results as on one thread.\n"
+                << "  Balance them so that neither waits: searching takes longer the larger <n_artifacts>." << std::endl;
+      std::cerr << "farm_one <n_artifacts> [k] [--threads <t>]" << std::endl;
+      std::cerr << "  Farm <n_artifacts> artifacts and print the best set of artifacts achieved,\n"
+                << "  and the damage of the next best of the k best sets. For fun or debugging.\n"
+                << "  With k = 1, large inventories are searched on <t> threads, one per core by default,\n"
+                << "  finding the same set as on one thread. The k > 1 best sets are always searched on one\n"
+                << "  thread, which is much slower for large <n_artifacts>, so k defaults to 1 if --threads\n"
+                << "  is given or <n_artifacts> > " << FARM_ONE_TOP_K_MAX_N << ", and to " << FARM_ONE_TOP_K
+                << " otherwise. --threads requires k = 1." << std::endl;
+      std::cerr << "farm_to <iters> <damage_target> <max_n> [&]" << std::endl;
+      std::cerr << "  Simulate <iters> people farming until their best set reaches <damage_target>, giving up\n"
+                << "  after <max_n> artifacts, and print the distribution of artifacts and resin needed\n"
+                << "  (" << RESIN_PER_RUN << " resin per run, " << ARTIFACTS_PER_RUN_X100 / 100.0
+                << " artifacts per run on average). Uses the seed, but not the artifact cache or generator." << std::endl;
+      std::cerr << "matrix <iters> <n_artifacts> [&]" << std::endl;
+      std::cerr << "  Simulate <iters> people farming <n_artifacts> artifacts each, and optimize every pair of\n"
+                << "  character and weapon configs on each person's artifacts. Prints the mean damage of every\n"
+                << "  pair, and how much less each weapon gets than the best one for the character, measured\n"
+                << "  on the same artifacts. Ignores the artifact cache and generator settings." << std::endl;
+      std::cerr << "farm_script <iters> <start_n> <stop_n> <step> [--shard <i>/<N>] [--threads <k>] [--resume] [&]" << std::endl;
       std::cerr << "  Simulate <iters> people farming <n> artifacts each for every value of n from\n"
-                << "  <start_n> to <stop_n> stepping by <step> and write results to a output.csv file." << std::endl;
-      std::cerr << "roll <n>" << std::endl;
-      std::cerr << "  Roll n artifacts and print some statistics." << std::endl;
+                << "  <start_n> to <stop_n> stepping by <step> and write results to a output.csv file.\n"
+                << "  Runs on <k> threads, one per core by default, with the same results for any <k>.\n"
+                << "  With --shard, write partial results to farm_script_shard_<i>_of_<N>.txt instead.\n"
+                << "  Progress is checkpointed to farm_script[_shard_<i>_of_<N>].ckpt every minute.\n"
+                << "  With --resume, continue an interrupted run from its checkpoint. The arguments\n"
+                << "  other than --shard may then be left out." << std::endl;
+      std::cerr << "merge <shard_file> [<shard_file> ...]" << std::endl;
+      std::cerr << "  Combine the shard files of a run and print the results, or write them to output.csv\n"
+                << "  for farm_script. The output is the same as running all iterations in one process." << std::endl;
+      std::cerr << "policies <iters> <n_artifacts> <policy_config>" << std::endl;
+      std::cerr << "  Simulate <iters> people farming <n_artifacts> artifacts each, and compare the\n"
+                << "  staged upgrade policies in config/policies/<policy_config>.cfg on the same artifacts." << std::endl;
+      std::cerr << "tune <n_artifacts> [mean|median]" << std::endl;
+      std::cerr << "  Search for the min_stat_score, set_bonus_value, and domains that maximize the mean\n"
+                << "  (default) or median damage after farming <n_artifacts> artifacts, and write the\n"
+                << "  best farming config to config/characters/<character>_tuned.cfg." << std::endl;
+      std::cerr << "roll <n> [--threads <k>] [&]" << std::endl;
+      std::cerr << "  Roll n artifacts to +20 and print the share of each mainstat by slot, and the distributions\n"
+                << "  of crit value, score, and good rolls by slot and mainstat. Runs on <k> threads, one per\n"
+                << "  core by default, with the same results for any <k>. Memory doesn't grow with n." << std::endl;
+      std::cerr << "jobs" << std::endl;
+      std::cerr << "  List background jobs." << std::endl;
+      std::cerr << "status <id>" << std::endl;
+      std::cerr << "  Print the iterations done, artifacts/s, sets evaluated/s, and ETA of a job." << std::endl;
+      std::cerr << "cancel <id>" << std::endl;
+      std::cerr << "  Stop a job and print the statistics gathered so far. A cancelled farm_script\n"
+                << "  can be continued with --resume." << std::endl;
+      std::cerr << "weights [<iters> <n_artifacts>]" << std::endl;
+      std::cerr << "  Print the configured stat_score weights next to the ones derived from the damage formula\n"
+                << "  for the current weapon (used when derive_stat_score=true). With <iters> and <n_artifacts>,\n"
+                << "  also optimize <iters> runs of <n_artifacts> artifacts with both and compare the number of\n"
+                << "  sets evaluated and the damage found." << std::endl;
+      std::cerr << "verify [pools] [seed]" << std::endl;
+      std::cerr << "  Compare the optimizer with an exhaustive search without pruning, for every character config\n"
+                << "  with the current weapon, on [pools] (default 20) random and adversarial pools of each kind.\n"
+                << "  Prints the damage mismatches, ties, and speedup, and fails if the exact search or any\n"
+                << "  result is wrong, the exact search finds a different set on " << VERIFY_SEARCH_THREADS << " threads,\n"
+                << "  or the approximate optimizer misses the best set by more than " << 100 * VERIFY_APPROX_GAP
+                << "% or understates its bound.\n"
+                << "  Misses by GOOD_ROLLS_MARGIN pruning are reported but allowed.\n"
+                << "  Run by make verify." << std::endl;
       std::cerr << "roll_one" << std::endl;
       std::cerr << "  Roll one artifact and print it. For fun or debugging." << std::endl;
-      std::cerr << "seed" << std::endl;
-      std::cerr << "  Seed the RNG using current system time." << std::endl;
+      std::cerr << "seed [value]" << std::endl;
+      std::cerr << "  Seed the RNG using current system time, or the given value. farm and farm_script\n"
+                << "  results only depend on the configs, arguments, and seed." << std::endl;
+      std::cerr << "importance <tilt|off>" << std::endl;
+      std::cerr << "  Importance sample farm: upgrade the CR and CD substats of double crit pieces <tilt> times as\n"
+                << "  often (e.g. 1.15), and weight every run by the likelihood ratio of its drops. The weighted\n"
+                << "  99%ile and 99.9%ile then vary less for the same iterations, as long as the effective sample\n"
+                << "  size stays a large part of the iterations. Only works with the scalar generator, without\n"
+                << "  the artifact cache or shards." << std::endl;
+      std::cerr << "cache <seed|off>" << std::endl;
+      std::cerr << "  Farm from pre-generated artifacts stored in cache/ for the given seed, or stop using the cache.\n"
+                << "  Every config farming the same domains then gets exactly the same drops." << std::endl;
+      std::cerr << "bootstrap <drops|off> [replicates] [windows]" << std::endl;
+      std::cerr << "  Have farm and farm_script farm a pool of [replicates] (default " << BOOTSTRAP_REPLICATES
+                << ") independent replicates of\n"
+                << "  <drops> drops once per command, and build each iteration from n drops of one replicate,\n"
+                << "  drawn with replacement, or as a window of consecutive drops. An iteration then costs\n"
+                << "  little more than the optimizer. farm prints the standard errors across the replicates, and\n"
+                << "  warns when the pool adds more error than the iterations. Not used with shards, and its\n"
+                << "  results aren't cached." << std::endl;
+      std::cerr << "result_cache <on|off>" << std::endl;
+      std::cerr << "  farm and farm_script store their results in cache/results_<hash>.txt, keyed by the parsed\n"
+                << "  configs, n, seed, generator, and artifact cache. Running the same command again reuses them,\n"
+                << "  and a run with more iterations only simulates the missing ones. On by default." << std::endl;
+      std::cerr << "serve <socket_path> [threads]" << std::endl;
+      std::cerr << "  Answer JSON-lines farm and farm_one requests on a Unix domain socket until a client\n"
+                << "  sends a shutdown request. Requests share [threads] worker threads (default: one per core).\n"
+                << "  See server.cpp for the protocol." << std::endl;
+      std::cerr << "generator <scalar|batch|candidates>" << std::endl;
+      std::cerr << "  Choose how farm and farm_script generate artifacts. batch generates each farming run at\n"
+                << "  once with a vectorized RNG and only levels the pieces worth leveling. candidates draws how\n"
+                << "  many pieces of each slot become candidates for the optimizer, and then only generates\n"
+                << "  those, which is much faster for strict min_stat_score settings. All follow the same\n"
+                << "  distribution, but give different results for the same seed." << std::endl;
       std::cerr << "set <config_type> <value>" << std::endl;
       std::cerr << "  Change the character or weapon config to <value>." << std::endl;
       std::cerr << "settings" << std::endl;
@@ -239,5 +1666,8 @@ int main(/*int argc, char** argv*/) {
     std::cerr << "unknown command: " << input_list[0] << std::endl << std::endl;
   }  // end input loop
 
+  if (job_running("")) std::cerr << "Waiting for background jobs to finish..." << std::endl;
+  wait_for_jobs();
+  close_drop_cache(&drop_cache);
   return 0;
 }
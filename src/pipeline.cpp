@@ -0,0 +1,105 @@
+#include "pipeline.h"
+
+#include <thread>
+#include <vector>
+
+BoundedQueue::BoundedQueue(int capacity) : push_position(0), pop_position(0) {
+  size_t size = 1;
+  while (size < (size_t) capacity)
+    size *= 2;
+  cells.reset(new Cell[size]);
+  mask = size - 1;
+  for (size_t i = 0; i < size; i++)
+    cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+bool BoundedQueue::push(int value) {
+  size_t position = push_position.load(std::memory_order_relaxed);
+  while (true) {
+    Cell& cell = cells[position & mask];
+    const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    // The cell is free for this round once its value from the last round was popped
+    if (sequence == position) {
+      if (push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        cell.value = value;
+        cell.sequence.store(position + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (sequence < position) {
+      return false;
+    } else {
+      position = push_position.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool BoundedQueue::pop(int* value) {
+  size_t position = pop_position.load(std::memory_order_relaxed);
+  while (true) {
+    Cell& cell = cells[position & mask];
+    const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    if (sequence == position + 1) {
+      if (pop_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        *value = cell.value;
+        // Free the cell for the push of the next round
+        cell.sequence.store(position + mask + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (sequence < position + 1) {
+      return false;
+    } else {
+      position = pop_position.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void run_pipeline(int begin, int end, int producers, int consumers,
+                  const std::function<void(int producer, int iter, FarmWorkspace* workspace)>& produce,
+                  const std::function<void(int consumer, FarmWorkspace& workspace)>& consume,
+                  const std::function<bool()>& cancelled) {
+  const int workspace_ct = producers + PIPELINE_WORKSPACES_PER_CONSUMER * consumers;
+  std::vector<FarmWorkspace> workspaces(workspace_ct);
+  // Every workspace is in at most one queue at a time, so pushes never fail
+  BoundedQueue free_workspaces(workspace_ct), ready_workspaces(workspace_ct);
+  for (int i = 0; i < workspace_ct; i++)
+    free_workspaces.push(i);
+
+  std::atomic<int> next_iter(begin);
+  std::atomic<int> producers_running(producers);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&, p] {
+      while (!cancelled()) {
+        const int iter = next_iter.fetch_add(1);
+        if (iter >= end) break;
+        int idx;
+        // All workspaces are farmed ahead, wait for a consumer to finish one
+        while (!free_workspaces.pop(&idx))
+          std::this_thread::yield();
+        produce(p, iter, &workspaces[idx]);
+        workspaces[idx].iter = iter;
+        ready_workspaces.push(idx);
+      }
+      producers_running.fetch_sub(1, std::memory_order_release);
+    });
+  }
+  for (int c = 0; c < consumers; c++) {
+    threads.emplace_back([&, c] {
+      while (true) {
+        // Once the producers are done, every workspace they farmed is in the ready queue
+        const bool produced = producers_running.load(std::memory_order_acquire) == 0;
+        int idx;
+        if (ready_workspaces.pop(&idx)) {
+          consume(c, workspaces[idx]);
+          free_workspaces.push(idx);
+        } else if (produced) {
+          break;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+}
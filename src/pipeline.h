@@ -0,0 +1,57 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+#include "farm.h"
+
+// Bounded queue of ints that any number of threads push to and pop from without locking.
+// Every cell has a sequence number telling whether it is ready for the push or the pop of the current
+// round, so pushes and pops only contend on their position counter (Vyukov's bounded MPMC queue).
+class BoundedQueue {
+ public:
+  // Holds up to capacity values, rounded up to a power of 2.
+  explicit BoundedQueue(int capacity);
+  BoundedQueue(const BoundedQueue& other) = delete;
+  BoundedQueue& operator=(const BoundedQueue& other) = delete;
+
+  // Returns false instead of waiting if the queue is full.
+  bool push(int value);
+  // Returns false instead of waiting if the queue is empty.
+  bool pop(int* value);
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    int value;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  // On separate cache lines, so that producers and consumers don't slow each other down
+  alignas(64) std::atomic<size_t> push_position;
+  alignas(64) std::atomic<size_t> pop_position;
+};
+
+// Workspaces per consumer of a pipeline, besides one per producer: the one it searches, and one
+// farmed ahead, so that it never waits for a producer that keeps up on average.
+constexpr int PIPELINE_WORKSPACES_PER_CONSUMER = 2;
+
+// Runs farm iterations [begin, end) in two stages on separate threads. Producers claim the
+// iterations in order and farm their candidates into free workspaces with produce, which pass
+// through a queue of ready workspaces to consumers searching them for the best set with consume,
+// and back through a queue of free workspaces. Both queues are BoundedQueues of workspace indices,
+// and the workspaces are reused, so no buffers are allocated once they reach their largest size.
+// Consumers get the iterations in about the order they were claimed, but not exactly, so anything
+// they add up must not depend on the order. produce and consume get the index of the thread running
+// them, in [0, producers) and [0, consumers). Once cancelled returns true, no more iterations are
+// farmed, and the ones farmed already are still consumed.
+void run_pipeline(int begin, int end, int producers, int consumers,
+                  const std::function<void(int producer, int iter, FarmWorkspace* workspace)>& produce,
+                  const std::function<void(int consumer, FarmWorkspace& workspace)>& consume,
+                  const std::function<bool()>& cancelled);
+
+#endif
@@ -0,0 +1,85 @@
+#include "policy.h"
+
+#include "gen_artifact.h"
+
+// Artifact EXP data taken from https://genshin-impact.fandom.com/wiki/Artifacts/EXP
+const int UPGRADE_EXP[UPGRADE_STAGE_CT] = {16300, 44725, 87150, 153300, 270475};
+
+void farm_policies(Character& character, Weapon& weapon, int n,
+    std::vector<UpgradePolicy>& policies, std::vector<PolicyResult>* results) {
+  FarmingConfig& farming_config = character.farming_config;
+  const int policy_ct = (int) policies.size();
+  std::vector<FarmedSet> max_sets(policy_ct);
+
+  // Step 1: Generate n artifacts and level them as far as any policy requires.
+  // Store the +20 artifacts once, and for each policy the indices of the ones it leveled.
+  Artifact* upgraded = get_artifact_storage(n);
+  int upgraded_ct = 0;
+  std::vector<std::vector<int>> leveled(policy_ct);
+  std::vector<int> active(policy_ct);
+  for (int i = 0; i < n; i++) {
+    Artifact arti;
+    gen_random(&arti, farming_config);
+    for (int p = 0; p < policy_ct; p++) {
+      max_sets[p].upgrade_ratio[arti.slot][1]++;
+      active[p] = p;
+    }
+    int active_ct = policy_ct;
+
+    for (int stage = 0; stage < UPGRADE_STAGE_CT && active_ct > 0; stage++) {
+      int score = farming_config.score(arti);
+      // Drop the policies that abandon the artifact at this stage
+      int remaining = 0;
+      for (int j = 0; j < active_ct; j++) {
+        const int p = active[j];
+        if (score < policies[p].min_stat_score[stage][arti.slot]) {
+          (*results)[p].abandoned[stage]++;
+          if (stage > 0) (*results)[p].exp_spent += UPGRADE_EXP[stage-1];
+        } else {
+          active[remaining] = p;
+          remaining++;
+        }
+      }
+      active_ct = remaining;
+      // The upgrade is rolled once for all policies still leveling the artifact
+      if (active_ct > 0) upgrade_once(&arti);
+    }
+    if (active_ct == 0) continue;
+
+    arti.stat_score = farming_config.score(arti);
+    upgraded[upgraded_ct] = arti;
+    for (int j = 0; j < active_ct; j++) {
+      const int p = active[j];
+      leveled[p].push_back(upgraded_ct);
+      max_sets[p].upgrade_ratio[arti.slot][0]++;
+      (*results)[p].exp_spent += UPGRADE_EXP[UPGRADE_STAGE_CT-1];
+    }
+    upgraded_ct++;
+  }
+
+  // Step 2: Find the best set for each policy
+  Artifact* candidates = get_artifact_storage(upgraded_ct);
+  for (int p = 0; p < policy_ct; p++) {
+    // Policies that leveled exactly the same artifacts end up with the same set
+    int same = -1;
+    for (int q = 0; q < p; q++) {
+      if (leveled[q] == leveled[p]) {
+        same = q;
+        break;
+      }
+    }
+
+    if (same >= 0) {
+      max_sets[p] = max_sets[same];
+    } else {
+      const int size = (int) leveled[p].size();
+      for (int i = 0; i < size; i++)
+        candidates[i] = upgraded[leveled[p][i]];
+      optimize_set(character, weapon, candidates, size, &max_sets[p]);
+    }
+    (*results)[p].all_max_sets.push_back(max_sets[p]);
+  }
+
+  delete[] candidates;
+  delete[] upgraded;
+}
@@ -0,0 +1,45 @@
+#ifndef __POLICY_H__
+#define __POLICY_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "farm.h"
+#include "types.h"
+
+// Artifacts are checked at +0, +4, +8, +12, and +16 before each upgrade.
+constexpr int UPGRADE_STAGE_CT = 5;
+
+// Cumulative artifact EXP required to level a 5* artifact from +0 to +4, +8, +12, +16, and +20.
+extern const int UPGRADE_EXP[UPGRADE_STAGE_CT];
+
+// A staged upgrade policy. At each stage, an artifact is only leveled further if its
+// stat score at the current level meets the threshold for its slot.
+struct UpgradePolicy {
+  std::string name;
+  // min_stat_score[i][slot] is the minimum score required at +4*i to keep leveling
+  int min_stat_score[UPGRADE_STAGE_CT][SLOT_CT];
+};
+
+// Accumulated results of one policy over all farming iterations.
+struct PolicyResult {
+  std::vector<FarmedSet> all_max_sets;
+  // Total artifact EXP spent over all iterations
+  int64_t exp_spent;
+  // Number of artifacts abandoned at each stage over all iterations
+  int64_t abandoned[UPGRADE_STAGE_CT];
+
+  PolicyResult() : exp_spent(0) {
+    for (int i = 0; i < UPGRADE_STAGE_CT; i++)
+      abandoned[i] = 0;
+  }
+};
+
+// Farm n artifacts once and evaluate every policy on the same drops, appending one
+// FarmedSet per policy to results. Each upgrade is rolled once and shared by all policies
+// that level the artifact that far. results must have the same size as policies.
+void farm_policies(Character& character, Weapon& weapon, int n,
+    std::vector<UpgradePolicy>& policies, std::vector<PolicyResult>* results);
+
+#endif
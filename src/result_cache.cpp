@@ -0,0 +1,112 @@
+#include "result_cache.h"
+
+#include <mutex>
+#include <sstream>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "text_io.h"
+
+namespace {
+
+// Background jobs may store results for the same key at the same time
+std::mutex write_mutex;
+
+// 64 bit FNV-1a hash of a sequence of integers
+struct KeyHasher {
+  uint64_t hash = 14695981039346656037ULL;
+
+  void add(int64_t value) {
+    for (int i = 0; i < 8; i++) {
+      hash ^= (value >> (8 * i)) & 0xff;
+      hash *= 1099511628211ULL;
+    }
+  }
+};
+
+void add_farming_config(KeyHasher* hasher, const FarmingConfig& fcfg) {
+  hasher->add(fcfg.domains.size());
+  for (Domain d : fcfg.domains)
+    hasher->add(d);
+  for (int i = 0; i < SET_CT; i++) {
+    for (int j = 0; j < SET_PIECES_CT; j++)
+      hasher->add(fcfg.target_sets[i][j]);
+  }
+  for (int i = 0; i < MAINSTAT_CT; i++)
+    hasher->add(fcfg.stat_score[i]);
+  hasher->add(fcfg.stat_score_max);
+  hasher->add(fcfg.derive_stat_score);
+  hasher->add(fcfg.mainstat_multiplier);
+  hasher->add(fcfg.set_bonus_value);
+  for (int i = 0; i < SLOT_CT; i++)
+    hasher->add(fcfg.min_stat_score[i]);
+  hasher->add(fcfg.constraints.size());
+  for (const StatConstraint& constraint : fcfg.constraints) {
+    hasher->add(constraint.stat);
+    hasher->add(constraint.min);
+    hasher->add(constraint.max);
+  }
+}
+
+}  // namespace
+
+uint64_t result_key_hash(const ResultKey& key) {
+  KeyHasher hasher;
+  hasher.add(RESULT_CACHE_VERSION);
+
+  const Character& c = *key.character;
+  hasher.add(c.base_atk);
+  hasher.add(c.reaction_multiplier_x10);
+  hasher.add(c.reaction_percentage);
+  hasher.add(c.damage_type);
+  for (int i = 0; i < STAT_CT; i++)
+    hasher.add(c.stats[i]);
+  add_farming_config(&hasher, c.farming_config);
+
+  hasher.add(key.weapon->base_atk);
+  for (int i = 0; i < STAT_CT; i++)
+    hasher.add(key.weapon->stats[i]);
+
+  hasher.add(key.n);
+  // The master seed and generator don't matter when the drops come from the artifact cache
+  hasher.add(key.use_drop_cache);
+  if (key.use_drop_cache) {
+    hasher.add(key.drop_cache_seed);
+  } else {
+    hasher.add(key.master_seed);
+    hasher.add(key.generator);
+  }
+  return hasher.hash;
+}
+
+std::string cached_result_file(uint64_t hash) {
+  std::ostringstream name;
+  name << "cache/results_" << std::hex << hash << ".txt";
+  return name.str();
+}
+
+bool read_cached_result(uint64_t hash, ShardResult* result) {
+  if (!read_shard_result(cached_result_file(hash), result)) return false;
+  return result->n.size() == 1 && result->accumulators[0].count == result->iters;
+}
+
+bool write_cached_result(uint64_t hash, const ShardResult& result) {
+#ifdef _WIN32
+  _mkdir("cache");
+#else
+  mkdir("cache", 0755);
+#endif
+  std::lock_guard<std::mutex> lock(write_mutex);
+  // Another run may have stored more iterations in the meantime
+  ShardResult stored;
+  if (read_cached_result(hash, &stored) && stored.iters >= result.iters) return true;
+  // Replace the file in one step, so that a reader never sees it partially written
+  const std::string filename = cached_result_file(hash);
+  const std::string tmp_filename = filename + ".tmp";
+  if (!write_shard_result(tmp_filename, result)) return false;
+  return replace_file(tmp_filename, filename);
+}
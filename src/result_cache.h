@@ -0,0 +1,43 @@
+#ifndef __RESULT_CACHE_H__
+#define __RESULT_CACHE_H__
+
+#include <cstdint>
+#include <string>
+
+#include "analyze.h"
+#include "farm.h"
+#include "types.h"
+
+// On-disk cache of the accumulated results of seeded farm iterations. Iteration i of a run only
+// depends on the configs, n, where the drops come from, and i, so the results of iterations
+// [0, count) can be stored under a hash of those inputs and extended by later runs with more iterations.
+
+// Identifies the simulator version of cached results.
+// Must be changed whenever a change to artifact generation, the optimizer, or the damage formula
+// changes the results of seeded farm iterations.
+constexpr int RESULT_CACHE_VERSION = 3;
+
+// Everything the results of seeded farm iterations depend on.
+struct ResultKey {
+  const Character* character;
+  const Weapon* weapon;
+  int n;
+  // Drops come from the artifact cache with drop_cache_seed if use_drop_cache,
+  // and otherwise from the generator seeded with master_seed
+  uint64_t master_seed;
+  Generator generator;
+  bool use_drop_cache;
+  uint64_t drop_cache_seed;
+};
+
+// Returns the hash of the parsed configs, n, drop source, and RESULT_CACHE_VERSION.
+uint64_t result_key_hash(const ResultKey& key);
+// Reads the results stored for the key into result, which then holds iterations [0, result->iters).
+// Returns false if there are none.
+bool read_cached_result(uint64_t hash, ShardResult* result);
+// Stores the results of iterations [0, result.iters) for the key, unless as many are stored already.
+bool write_cached_result(uint64_t hash, const ShardResult& result);
+// Returns the file results for the key are stored in.
+std::string cached_result_file(uint64_t hash);
+
+#endif
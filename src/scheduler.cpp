@@ -0,0 +1,58 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+
+WorkStealingScheduler::WorkStealingScheduler(int thread_ct) : threads(thread_ct) {
+  if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+bool WorkStealingScheduler::take(std::vector<WorkerQueue>& queues, int worker, Task* task) {
+  // The worker's own deque first, then the others starting with its neighbour
+  for (int i = 0; i < threads; i++) {
+    WorkerQueue& queue = queues[(worker + i) % threads];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) continue;
+    *task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return true;
+  }
+  return false;
+}
+
+void WorkStealingScheduler::run(const std::vector<Task>& tasks, std::function<void()> poll,
+                                std::chrono::milliseconds poll_interval) {
+  std::vector<WorkerQueue> queues(threads);
+  for (unsigned int i = 0; i < tasks.size(); i++)
+    queues[i % threads].tasks.push_back(tasks[i]);
+
+  // No tasks are added while running, so a worker finding every deque empty is done
+  std::atomic<int> running(threads);
+  std::mutex finished_mutex;
+  std::condition_variable finished;
+  std::vector<std::thread> workers;
+  for (int w = 0; w < threads; w++) {
+    workers.emplace_back([this, &queues, &running, &finished_mutex, &finished, w] {
+      Task task;
+      while (take(queues, w, &task))
+        task(w);
+      if (running.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(finished_mutex);
+        finished.notify_all();
+      }
+    });
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(finished_mutex);
+    while (!finished.wait_for(lock, poll_interval, [&running] { return running.load() == 0; })) {
+      lock.unlock();
+      poll();
+      lock.lock();
+    }
+  }
+  for (std::thread& worker : workers)
+    worker.join();
+}
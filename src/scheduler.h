@@ -0,0 +1,43 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Runs a fixed set of tasks on worker threads that each have their own deque of tasks.
+// A worker takes tasks from the front of its own deque, and once that is empty steals from the
+// front of the others, so no worker idles while any task is left.
+// Tasks are dealt to the deques round robin in the order given. Giving them longest first
+// schedules the longest tasks first, leaving the short ones to even out the finishing times.
+class WorkStealingScheduler {
+ public:
+  // A task gets the index of the worker running it, in [0, size())
+  typedef std::function<void(int worker)> Task;
+
+  // Uses the given number of workers, or one per hardware thread if threads <= 0.
+  explicit WorkStealingScheduler(int threads);
+  WorkStealingScheduler(const WorkStealingScheduler& other) = delete;
+  WorkStealingScheduler& operator=(const WorkStealingScheduler& other) = delete;
+
+  // Runs every task and returns once all of them finished. Meanwhile the calling thread
+  // calls poll every poll_interval, e.g. to report or save progress.
+  void run(const std::vector<Task>& tasks, std::function<void()> poll, std::chrono::milliseconds poll_interval);
+  // Runs every task and returns once all of them finished.
+  void run(const std::vector<Task>& tasks) { run(tasks, [] {}, std::chrono::milliseconds(1000)); }
+  int size() const { return threads; }
+
+ private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  bool take(std::vector<WorkerQueue>& queues, int worker, Task* task);
+
+  int threads;
+};
+
+#endif
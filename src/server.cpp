@@ -0,0 +1,478 @@
+#include "server.h"
+
+// Protocol: requests and responses are single line JSON objects. Responses may arrive in a
+// different order than requests, so clients should match them by id.
+//
+// Request fields:
+//   id         Any JSON value, echoed in the response.
+//   command    "farm", "farm_one", "ping", or "shutdown".
+//   character  Character config name, or an inline profile: an object using the config file keys,
+//              with the farming config as a nested "farming_config" object and lists as arrays.
+//   weapon     Weapon config name, or an inline profile.
+//   iters      Number of people to simulate (farm only).
+//   n          Number of artifacts each person farms.
+//   seed       Master seed, 0 by default. Results only depend on the configs, iters, n, and seed.
+//   k          Number of best sets to find, 1 by default (farm_one only).
+//   generator  "scalar" (default), "batch", or "candidates" (farm only).
+//
+// Responses contain "id" and "ok", plus "error" if ok is false, or the results of the command:
+//   farm       mean, stddev, percentiles (0 to 100), good_rolls, crit_value,
+//              upgrade_ratio (% per slot), set_bonus_pcts, time (seconds)
+//   farm_one   damage, upgrade_ratio, artifacts (set, slot, mainstat, substats),
+//              runners_up (damage of the next best sets)
+
+#ifdef _WIN32
+
+#include <iostream>
+
+bool run_server(const std::string& /*socket_path*/, int /*threads*/) {
+  std::cerr << "Error: the server is not supported on Windows." << std::endl;
+  return false;
+}
+
+#else
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "analyze.h"
+#include "farm.h"
+#include "gen_artifact.h"
+#include "json.h"
+#include "text_io.h"
+#include "thread_pool.h"
+#include "types.h"
+
+namespace {
+
+// Iterations of a farm request run by one thread pool task
+constexpr int ITERS_PER_TASK = 16;
+// Most sets a farm_one request may ask for
+constexpr int MAX_TOP_SETS = 100;
+// Longest request line accepted from a client
+constexpr size_t MAX_REQUEST_SIZE = 1 << 20;
+
+// A client connection. Responses may be written by any thread.
+struct Connection {
+  int fd;
+  std::mutex write_mutex;
+
+  explicit Connection(int f) : fd(f) {}
+  ~Connection() { close(fd); }
+
+  void send_line(const std::string& line) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    const std::string data = line + "\n";
+    size_t sent = 0;
+    while (sent < data.size()) {
+      // Don't raise SIGPIPE if the client has already disconnected
+      ssize_t result = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (result <= 0) return;
+      sent += result;
+    }
+  }
+};
+
+struct Server {
+  ThreadPool pool;
+  int listen_fd;
+  std::atomic<bool> stopping;
+
+  // Parsed configs, by name or by config text for inline profiles
+  std::mutex config_mutex;
+  std::map<std::string, Character> characters;
+  std::map<std::string, Weapon> weapons;
+
+  // Open connections, so that they can be closed on shutdown. Connection threads are detached, and
+  // the last one to finish notifies connections_closed, so finished threads don't pile up.
+  std::mutex connection_mutex;
+  std::condition_variable connections_closed;
+  std::set<int> connection_fds;
+
+  explicit Server(int threads) : pool(threads), listen_fd(-1), stopping(false) {}
+};
+
+// A farm request split over several thread pool tasks.
+struct FarmRequest {
+  std::string id;
+  std::shared_ptr<Connection> connection;
+  Character character;
+  Weapon weapon;
+  int iters;
+  int n;
+  uint64_t seed;
+  Generator generator;
+  std::chrono::steady_clock::time_point start;
+
+  std::mutex mutex;
+  FarmedSetAccumulator acc;
+  std::atomic<int> tasks_left;
+};
+
+std::string error_response(const std::string& id, const std::string& error) {
+  return "{\"id\":" + id + ",\"ok\":false,\"error\":" + json_string(error) + "}";
+}
+
+std::string format_scalar(const JsonValue& v) {
+  if (v.type == JsonValue::STRING) return v.str;
+  if (v.type == JsonValue::BOOLEAN) return v.boolean ? "true" : "false";
+  std::ostringstream out;
+  out.precision(15);
+  out << v.number;
+  return out.str();
+}
+
+// Converts an inline JSON profile into config file lines, so that it is parsed like a config file.
+std::string profile_to_cfg(const JsonValue& profile) {
+  std::string cfg;
+  for (const auto& member : profile.object) {
+    const JsonValue& v = member.second;
+    if (v.type == JsonValue::OBJECT) {
+      cfg += member.first + " {\n" + profile_to_cfg(v) + "}\n";
+    } else if (v.type == JsonValue::ARRAY) {
+      cfg += member.first + "=";
+      for (unsigned int i = 0; i < v.array.size(); i++)
+        cfg += (i > 0 ? "," : "") + format_scalar(v.array[i]);
+      cfg += "\n";
+    } else {
+      cfg += member.first + "=" + format_scalar(v) + "\n";
+    }
+  }
+  return cfg;
+}
+
+// Only plain file names may be used to load configs, so clients cannot read arbitrary files.
+bool valid_config_name(const std::string& name) {
+  return !name.empty() && name.find('/') == std::string::npos
+      && name.find('\\') == std::string::npos && name.find("..") == std::string::npos;
+}
+
+// Looks up a character from the cache, parsing and caching it on first use.
+bool get_character(Server& server, const JsonValue* spec, Character* c, std::string* error) {
+  std::string key;
+  if (spec != nullptr && spec->type == JsonValue::STRING && valid_config_name(spec->str)) {
+    key = "name:" + spec->str;
+  } else if (spec != nullptr && spec->type == JsonValue::OBJECT) {
+    key = "inline:" + profile_to_cfg(*spec);
+  } else {
+    *error = "character must be a config name or a profile object";
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(server.config_mutex);
+  auto it = server.characters.find(key);
+  if (it == server.characters.end()) {
+    Character parsed = {};
+    bool valid = false;
+    // The config parser throws on malformed numbers, which must not take down the server
+    try {
+      if (spec->type == JsonValue::STRING) {
+        valid = read_character_config(spec->str, &parsed);
+      } else {
+        std::istringstream config(key.substr(7));
+        valid = read_character_config(config, &parsed);
+      }
+    } catch (const std::exception&) {
+      *error = (spec->type == JsonValue::STRING) ? "invalid character config" : "invalid character profile";
+      return false;
+    }
+    if (!valid || parsed.farming_config.domains.empty()) {
+      *error = "invalid character config";
+      return false;
+    }
+    it = server.characters.insert({key, parsed}).first;
+  }
+  *c = it->second;
+  return true;
+}
+
+// Looks up a weapon from the cache, parsing and caching it on first use.
+bool get_weapon(Server& server, const JsonValue* spec, Weapon* w, std::string* error) {
+  std::string key;
+  if (spec != nullptr && spec->type == JsonValue::STRING && valid_config_name(spec->str)) {
+    key = "name:" + spec->str;
+  } else if (spec != nullptr && spec->type == JsonValue::OBJECT) {
+    key = "inline:" + profile_to_cfg(*spec);
+  } else {
+    *error = "weapon must be a config name or a profile object";
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(server.config_mutex);
+  auto it = server.weapons.find(key);
+  if (it == server.weapons.end()) {
+    Weapon parsed = {};
+    bool valid = false;
+    try {
+      if (spec->type == JsonValue::STRING) {
+        valid = read_weapon_config(spec->str, &parsed);
+      } else {
+        std::istringstream config(key.substr(7));
+        valid = read_weapon_config(config, &parsed);
+      }
+    } catch (const std::exception&) {
+      *error = (spec->type == JsonValue::STRING) ? "invalid weapon config" : "invalid weapon profile";
+      return false;
+    }
+    if (!valid) {
+      *error = "invalid weapon config";
+      return false;
+    }
+    it = server.weapons.insert({key, parsed}).first;
+  }
+  *w = it->second;
+  return true;
+}
+
+// Reads a non-negative integer field, using default_value if it is missing.
+bool get_int(const JsonValue& request, const std::string& key, int64_t default_value, int64_t* value) {
+  const JsonValue* v = request.get(key);
+  if (v == nullptr) {
+    *value = default_value;
+    return default_value >= 0;
+  }
+  if (v->type != JsonValue::NUMBER || v->number < 0 || v->number > 9e15) return false;
+  *value = (int64_t) v->number;
+  return true;
+}
+
+std::string farm_response(FarmRequest& req) {
+  const FarmedSetStats stats = analyze_farmed_set(req.acc);
+  const double time = std::chrono::duration_cast<std::chrono::duration<double>>(
+      std::chrono::steady_clock::now() - req.start).count();
+
+  std::ostringstream out;
+  out << "{\"id\":" << req.id << ",\"ok\":true,\"command\":\"farm\""
+      << ",\"iters\":" << req.iters << ",\"n\":" << req.n << ",\"seed\":" << req.seed
+      << ",\"time\":" << time
+      << ",\"mean\":" << stats.mean << ",\"stddev\":" << stats.stddev << ",\"percentiles\":[";
+  for (int i = 0; i < 101; i++)
+    out << (i > 0 ? "," : "") << stats.percentiles[i];
+  out << "],\"good_rolls\":" << stats.good_rolls << ",\"crit_value\":" << stats.crit_value
+      << ",\"upgrade_ratio\":[";
+  for (int i = 0; i < SLOT_CT; i++)
+    out << (i > 0 ? "," : "") << print_percentage(stats.upgrade_ratio[i][0], stats.upgrade_ratio[i][1]);
+  out << "],\"set_bonus_pcts\":[";
+  for (int i = 0; i < 4; i++)
+    out << (i > 0 ? "," : "") << stats.set_bonus_pcts[i];
+  out << "]}";
+  return out.str();
+}
+
+std::string farm_one_response(const std::string& id, const FarmedSet& max_set, const std::vector<FarmedSet>& top_sets) {
+  std::ostringstream out;
+  out << "{\"id\":" << id << ",\"ok\":true,\"command\":\"farm_one\",\"damage\":" << max_set.damage
+      << ",\"upgrade_ratio\":[";
+  for (int i = 0; i < SLOT_CT; i++)
+    out << (i > 0 ? "," : "") << print_percentage(max_set.upgrade_ratio[i][0], max_set.upgrade_ratio[i][1]);
+  out << "],\"artifacts\":[";
+  for (int i = 0; i < SLOT_CT && max_set.damage > 0; i++) {
+    const Artifact& a = max_set.artifacts[i];
+    out << (i > 0 ? "," : "") << "{\"set\":" << json_string(print_set(a.set))
+        << ",\"slot\":" << json_string(print_slot(a.slot))
+        << ",\"mainstat\":" << json_string(print_stat(a.mainstat))
+        << ",\"mainstat_value\":" << print_stat_value(a.mainstat, MAINSTAT_LEVEL[a.mainstat])
+        << ",\"substats\":{";
+    for (int j = 0; j < 4; j++) {
+      const Stat substat = static_cast<Stat>(a.substats[j]);
+      out << (j > 0 ? "," : "") << json_string(print_stat(substat)) << ":"
+          << print_stat_value(substat, a.substat_values[substat]);
+    }
+    out << "}}";
+  }
+  out << "],\"runners_up\":[";
+  for (unsigned int i = 1; i < top_sets.size(); i++)
+    out << (i > 1 ? "," : "") << top_sets[i].damage;
+  out << "]}";
+  return out.str();
+}
+
+void handle_request(Server& server, std::shared_ptr<Connection> connection, const std::string& line) {
+  JsonValue request;
+  if (!parse_json(line, &request) || request.type != JsonValue::OBJECT) {
+    connection->send_line(error_response("null", "request is not a JSON object"));
+    return;
+  }
+  const JsonValue* id_value = request.get("id");
+  const std::string id = (id_value != nullptr) ? json_dump(*id_value) : "null";
+  const JsonValue* command_value = request.get("command");
+  const std::string command = (command_value != nullptr) ? command_value->str : "";
+
+  if (command == "ping") {
+    connection->send_line("{\"id\":" + id + ",\"ok\":true,\"command\":\"ping\"}");
+    return;
+  }
+  if (command == "shutdown") {
+    connection->send_line("{\"id\":" + id + ",\"ok\":true,\"command\":\"shutdown\"}");
+    server.stopping = true;
+    // Wake up the accept loop
+    shutdown(server.listen_fd, SHUT_RDWR);
+    return;
+  }
+  if (command != "farm" && command != "farm_one") {
+    connection->send_line(error_response(id, "unknown command " + command));
+    return;
+  }
+
+  auto req = std::make_shared<FarmRequest>();
+  req->id = id;
+  req->connection = connection;
+  req->start = std::chrono::steady_clock::now();
+  std::string error;
+  int64_t iters = 0, n = 0, master_seed = 0, k = 1;
+  if (!get_character(server, request.get("character"), &req->character, &error)
+      || !get_weapon(server, request.get("weapon"), &req->weapon, &error)) {
+    connection->send_line(error_response(id, error));
+    return;
+  }
+  if (req->character.farming_config.derive_stat_score) apply_derived_stat_weights(req->character, req->weapon);
+  if (!get_int(request, "n", -1, &n) || n <= 0 || n > 100000000
+      || !get_int(request, "iters", command == "farm" ? -1 : 1, &iters) || iters <= 0 || iters > 100000000
+      || !get_int(request, "seed", 0, &master_seed)
+      || !get_int(request, "k", 1, &k) || k <= 0 || k > MAX_TOP_SETS) {
+    connection->send_line(error_response(id, "iters, n, seed, and k must be positive integers"));
+    return;
+  }
+  req->iters = (int) iters;
+  req->n = (int) n;
+  req->seed = master_seed;
+  req->generator = GENERATOR_SCALAR;
+  const JsonValue* generator_value = request.get("generator");
+  if (generator_value != nullptr && !read_generator(generator_value->str, &req->generator)) {
+    connection->send_line(error_response(id, "generator must be scalar, batch, or candidates"));
+    return;
+  }
+
+  if (command == "farm_one") {
+    const int top_k = (int) k;
+    server.pool.submit([req, top_k] {
+      seed(iteration_seed(req->seed, 0));
+      req->character.farming_config.domain_idx = 0;
+      std::vector<FarmedSet> top_sets;
+      FarmedSet max_set = farm(req->character, req->weapon, req->n, top_k, &top_sets);
+      req->connection->send_line(farm_one_response(req->id, max_set, top_sets));
+    });
+    return;
+  }
+
+  // Split the iterations into tasks. The last task to finish sends the response.
+  req->tasks_left = (req->iters + ITERS_PER_TASK - 1) / ITERS_PER_TASK;
+  for (int begin = 0; begin < req->iters; begin += ITERS_PER_TASK) {
+    const int end = std::min(req->iters, begin + ITERS_PER_TASK);
+    server.pool.submit([req, begin, end] {
+      Character c = req->character;
+      Weapon w = req->weapon;
+      FarmedSetAccumulator acc;
+      for (int i = begin; i < end; i++)
+        acc.add(c, farm(c, w, req->n, req->seed, i, req->generator));
+      {
+        std::lock_guard<std::mutex> lock(req->mutex);
+        req->acc.merge(acc);
+      }
+      if (--req->tasks_left == 0) req->connection->send_line(farm_response(*req));
+    });
+  }
+}
+
+void serve_connection(Server& server, std::shared_ptr<Connection> connection) {
+  std::string buffer;
+  char chunk[4096];
+  while (true) {
+    ssize_t received = recv(connection->fd, chunk, sizeof(chunk), 0);
+    if (received <= 0) break;
+    buffer.append(chunk, received);
+
+    size_t newline;
+    while ((newline = buffer.find('\n')) != std::string::npos) {
+      std::string line = buffer.substr(0, newline);
+      buffer.erase(0, newline + 1);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (!line.empty()) handle_request(server, connection, line);
+    }
+    if (buffer.size() > MAX_REQUEST_SIZE) {
+      connection->send_line(error_response("null", "request too long"));
+      break;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(server.connection_mutex);
+  server.connection_fds.erase(connection->fd);
+  if (server.connection_fds.empty()) server.connections_closed.notify_all();
+}
+
+}  // namespace
+
+bool run_server(const std::string& socket_path, int threads) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Error: socket path too long." << std::endl;
+    return false;
+  }
+  std::strcpy(addr.sun_path, socket_path.c_str());
+
+  // Remove a stale socket from an earlier server, but never any other kind of file
+  struct stat path_stat;
+  if (stat(socket_path.c_str(), &path_stat) == 0) {
+    if (!S_ISSOCK(path_stat.st_mode)) {
+      std::cerr << "Error: " << socket_path << " exists and is not a socket." << std::endl;
+      return false;
+    }
+    unlink(socket_path.c_str());
+  }
+
+  Server server(threads);
+  server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server.listen_fd < 0
+      || bind(server.listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+      || listen(server.listen_fd, 64) != 0) {
+    std::cerr << "Error: failed to listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+    if (server.listen_fd >= 0) close(server.listen_fd);
+    return false;
+  }
+  std::cerr << "Listening on " << socket_path << " with " << server.pool.size() << " threads." << std::endl;
+
+  while (!server.stopping) {
+    int fd = accept(server.listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR && !server.stopping) continue;
+      break;
+    }
+    std::lock_guard<std::mutex> lock(server.connection_mutex);
+    server.connection_fds.insert(fd);
+    std::thread(serve_connection, std::ref(server), std::make_shared<Connection>(fd)).detach();
+  }
+
+  // Stop reading new requests, and wait for every connection thread to finish. Requests already
+  // queued still finish and get their responses before the thread pool is destroyed.
+  {
+    std::unique_lock<std::mutex> lock(server.connection_mutex);
+    for (int fd : server.connection_fds)
+      shutdown(fd, SHUT_RD);
+    server.connections_closed.wait(lock, [&server] { return server.connection_fds.empty(); });
+  }
+
+  close(server.listen_fd);
+  unlink(socket_path.c_str());
+  std::cerr << "Server stopped." << std::endl;
+  return true;
+}
+
+#endif
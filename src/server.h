@@ -0,0 +1,12 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <string>
+
+// Run a simulation server listening on a Unix domain socket at socket_path, until a client sends
+// a shutdown request. Each line a client sends is a JSON request, answered with one JSON line.
+// Requests from all clients share a pool of the given number of threads (0 for one per core).
+// Returns false if the server could not be started. See server.cpp for the protocol.
+bool run_server(const std::string& socket_path, int threads);
+
+#endif
@@ -2,11 +2,22 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <utility>
 
+#ifdef _WIN32
+#include <io.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
 #include "analyze.h"
 
 namespace {
@@ -65,7 +76,16 @@ std::vector<std::pair<std::string, Domain>> domain_parse = {
   {"Ridge Watch", RIDGE_WATCH},
 };
 
-bool read_farming_config(std::ifstream& config, FarmingConfig* fcfg) {
+// Returns the constraint on the given stat, adding an unbounded one if there is none yet.
+StatConstraint* constraint_for(FarmingConfig* fcfg, Stat stat) {
+  for (StatConstraint& constraint : fcfg->constraints) {
+    if (constraint.stat == stat) return &constraint;
+  }
+  fcfg->constraints.push_back({stat, std::numeric_limits<int>::min(), std::numeric_limits<int>::max()});
+  return &fcfg->constraints.back();
+}
+
+bool read_farming_config(std::istream& config, FarmingConfig* fcfg) {
   // Clear the farming config
   *fcfg = {};
 
@@ -123,12 +143,15 @@ bool read_farming_config(std::ifstream& config, FarmingConfig* fcfg) {
       }
     } else if (key == "stat_score_max") {
       fcfg->stat_score_max = std::stoi(value);
+    } else if (key == "derive_stat_score") {
+      fcfg->derive_stat_score = (value == "true");
     } else if (key == "mainstat_multiplier") {
       fcfg->mainstat_multiplier = std::stoi(value);
     } else if (key == "set_bonus_value") {
       fcfg->set_bonus_value = std::stoi(value);
     } else if (key == "required_er") {
-      fcfg->required_er = (int) (10 * std::stod(value));
+      // Same as min_er
+      constraint_for(fcfg, ER)->min = (int) (STAT_MULTIPLIER[ER] * std::stod(value));
     } else if (key == "min_stat_score") {
       const auto min_score_list = split(value, ',');
       if (min_score_list.size() < SLOT_CT) {
@@ -138,6 +161,23 @@ bool read_farming_config(std::ifstream& config, FarmingConfig* fcfg) {
       for (int i = 0; i < SLOT_CT; i++) {
         fcfg->min_stat_score[i] = std::stoi(min_score_list[i]);
       }
+    } else if (key.compare(0, 4, "min_") == 0 || key.compare(0, 4, "max_") == 0) {
+      const std::string stat_str = key.substr(4);
+      auto it = std::find_if(
+          stat_parse.begin(), stat_parse.end(),
+          [&stat_str](const std::pair<std::string, Stat>& p) {
+            return p.first == stat_str;
+          });
+      // Only stats given by artifacts can be constrained
+      if (it == stat_parse.end() || it->second >= MAINSTAT_CT) {
+        std::cerr << "Invalid constraint " << key << std::endl;
+        return false;
+      }
+      const int bound = (int) (STAT_MULTIPLIER[it->second] * std::stod(value));
+      if (key[1] == 'i')
+        constraint_for(fcfg, it->second)->min = bound;
+      else
+        constraint_for(fcfg, it->second)->max = bound;
     } else {
       auto it = std::find_if(
           stat_parse.begin(), stat_parse.end(),
@@ -156,11 +196,124 @@ bool read_farming_config(std::ifstream& config, FarmingConfig* fcfg) {
   return true;
 }
 
+void write_shard_fields(std::ostream& out, const ShardResult& result) {
+  out << "command=" << result.command << "\n";
+  out << "character=" << result.character << "\n";
+  out << "weapon=" << result.weapon << "\n";
+  out << "seed=" << result.seed << "\n";
+  out << "generator=" << print_generator(result.generator) << "\n";
+  out << "iters=" << result.iters << "\n";
+  out << "shard=" << result.shard << "/" << result.shard_ct << "\n";
+  for (unsigned int i = 0; i < result.n.size(); i++) {
+    const FarmedSetAccumulator& acc = result.accumulators[i];
+    out << "n=" << result.n[i] << "\n";
+    out << "count=" << acc.count << "\n";
+    out << "damage_total=" << acc.damage_total << "\n";
+    out << "good_rolls=" << acc.good_rolls << "\n";
+    out << "crit_value=" << acc.crit_value << "\n";
+    out << "upgrade_ratio=";
+    for (int j = 0; j < SLOT_CT; j++)
+      out << (j > 0 ? "," : "") << acc.upgrade_ratio[j][0] << "," << acc.upgrade_ratio[j][1];
+    out << "\nset_bonus_counts=";
+    for (int j = 0; j < 4; j++)
+      out << (j > 0 ? "," : "") << acc.set_bonus_counts[j];
+    // Damage histogram as damage:count pairs
+    out << "\ndamage_histogram=";
+    bool first = true;
+    for (const auto& entry : acc.damage_histogram) {
+      out << (first ? "" : ",") << entry.first << ":" << entry.second;
+      first = false;
+    }
+    out << "\n";
+  }
+}
+
+// Parses one line written by write_shard_fields into result. Returns false for unknown lines.
+bool read_shard_field(const std::string& line, ShardResult* result) {
+  std::vector<std::string> kv_pair = split(line, '=');
+  if (kv_pair.size() < 2) {
+    // An empty damage histogram is the only valid line without a value
+    return line == "damage_histogram=" && !result->accumulators.empty();
+  }
+  const std::string& key = kv_pair[0];
+  const std::string& value = kv_pair[1];
+
+  if (key == "command") {
+    result->command = value;
+  } else if (key == "character") {
+    result->character = value;
+  } else if (key == "weapon") {
+    result->weapon = value;
+  } else if (key == "seed") {
+    result->seed = std::stoull(value);
+  } else if (key == "generator") {
+    return read_generator(value, &result->generator);
+  } else if (key == "iters") {
+    result->iters = std::stoi(value);
+  } else if (key == "shard") {
+    const auto shard_pair = split(value, '/');
+    if (shard_pair.size() < 2) return false;
+    result->shard = std::stoi(shard_pair[0]);
+    result->shard_ct = std::stoi(shard_pair[1]);
+  } else if (key == "n") {
+    result->n.push_back(std::stoi(value));
+    result->accumulators.push_back(FarmedSetAccumulator());
+  } else if (result->accumulators.empty()) {
+    return false;
+  } else {
+    FarmedSetAccumulator& acc = result->accumulators.back();
+    const auto values = split(value, ',');
+    if (key == "count") {
+      acc.count = std::stoll(value);
+    } else if (key == "damage_total") {
+      acc.damage_total = std::stoll(value);
+    } else if (key == "good_rolls") {
+      acc.good_rolls = std::stoll(value);
+    } else if (key == "crit_value") {
+      acc.crit_value = std::stoll(value);
+    } else if (key == "upgrade_ratio" && values.size() == 2 * SLOT_CT) {
+      for (int j = 0; j < SLOT_CT; j++) {
+        acc.upgrade_ratio[j][0] = std::stoll(values[2*j]);
+        acc.upgrade_ratio[j][1] = std::stoll(values[2*j+1]);
+      }
+    } else if (key == "set_bonus_counts" && values.size() == 4) {
+      for (int j = 0; j < 4; j++)
+        acc.set_bonus_counts[j] = std::stoll(values[j]);
+    } else if (key == "damage_histogram") {
+      for (const auto& entry : values) {
+        const auto damage_count = split(entry, ':');
+        if (damage_count.size() < 2) return false;
+        acc.damage_histogram[std::stoi(damage_count[0])] += std::stoll(damage_count[1]);
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Percentage of num in denom, with a percent sign, as one string for padding
+std::string print_share(int64_t num, int64_t denom) {
+  std::ostringstream out;
+  out << print_percentage(num, denom) << "%";
+  return out.str();
+}
+
+// Mean, median, and 99th percentile of a histogram, divided by scale
+std::string print_distribution(const Histogram& histogram, double scale) {
+  std::ostringstream out;
+  out << round(100.0 * histogram.mean() / scale) / 100.0 << " / " << histogram.percentile(50) / scale
+      << " / " << histogram.percentile(99) / scale;
+  return out.str();
+}
+
 }  // namespace
 
 void print_statistics(Character& c, std::vector<FarmedSet>& all_max_sets) {
-  FarmedSetStats stats = analyze_farmed_set(c, all_max_sets);
+  print_statistics(analyze_farmed_set(c, all_max_sets));
+}
 
+void print_statistics(const FarmedSetStats& stats) {
   std::cerr << "Mean damage: " << stats.mean << std::endl;
   std::cerr << "Stddev: " << stats.stddev << std::endl;
   std::cerr << "5%ile: " << stats.percentiles[5] << std::endl;
@@ -168,6 +321,12 @@ void print_statistics(Character& c, std::vector<FarmedSet>& all_max_sets) {
   std::cerr << "median: " << stats.percentiles[50] << std::endl;
   std::cerr << "75%ile: " << stats.percentiles[75] << std::endl;
   std::cerr << "95%ile: " << stats.percentiles[95] << std::endl;
+  std::cerr << "99%ile: " << stats.percentiles[99] << std::endl;
+  std::cerr << "99.9%ile: " << stats.percentile_99_9 << std::endl;
+  if (stats.importance_sampled) {
+    std::cerr << "Importance sampled, effective sample size: " << round(stats.effective_sample_size) << std::endl;
+    std::cerr << "(The damage statistics above are weighted, the ones below are of the tilted drops.)" << std::endl;
+  }
   std::cerr << "Avg number of good (offensive stat) rolls: " << stats.good_rolls << std::endl;
   std::cerr << "Avg (2*CR + CD) from substats: " << stats.crit_value << std::endl;
   std::cerr << "Upgrade ratio: ";
@@ -182,21 +341,86 @@ void print_statistics(Character& c, std::vector<FarmedSet>& all_max_sets) {
   std::cerr << std::endl;
 }
 
-void print_statistics(Artifact* sample, int size) {
-  int double_crit[5] = {0, 0, 0, 0, 0};
-  for (int i = 0; i < size; i++) {
-    const Artifact& a = sample[i];
-    if (a.substat_values[CR] > 0 && a.substat_values[CD] > 0) {
-      double_crit[a.slot]++;
+const char* const STATS_CSV_HEADER =
+    "Artifacts,Mean,Stddev,5%ile,25%ile,Median,75%ile,95%ile,Good Rolls,Avg(2*CR + CD),Upgrade ratio";
+
+void write_stats_row(std::ostream& out, int n, const FarmedSetStats& stats) {
+  out << n << ","
+      << stats.mean << ","
+      << stats.stddev << ","
+      << stats.percentiles[5] << ","
+      << stats.percentiles[25] << ","
+      << stats.percentiles[50] << ","
+      << stats.percentiles[75] << ","
+      << stats.percentiles[95] << ","
+      << stats.good_rolls << ","
+      << stats.crit_value << ","
+      << print_percentage(stats.total_upgrade_ratio[0], stats.total_upgrade_ratio[1]) << "%" << std::endl;
+}
+
+void print_statistics(Character& c, std::vector<UpgradePolicy>& policies, std::vector<PolicyResult>& results) {
+  for (unsigned int p = 0; p < policies.size(); p++) {
+    const int size = (int) results[p].all_max_sets.size();
+    FarmedSetStats stats = analyze_farmed_set(c, results[p].all_max_sets);
+
+    std::cerr << policies[p].name << std::endl;
+    std::cerr << " Mean damage: " << stats.mean
+              << " | 5%ile: " << stats.percentiles[5]
+              << " | median: " << stats.percentiles[50]
+              << " | 95%ile: " << stats.percentiles[95] << std::endl;
+    std::cerr << " Avg EXP spent: " << results[p].exp_spent / size
+              << " | Avg damage per million EXP: "
+              << round(100.0 * stats.mean * size * 1000000.0 / std::max<int64_t>(1, results[p].exp_spent)) / 100.0 << std::endl;
+    std::cerr << " Avg abandoned at +0/+4/+8/+12/+16: ";
+    for (int i = 0; i < UPGRADE_STAGE_CT; i++) {
+      std::cerr << round(100.0 * results[p].abandoned[i] / size) / 100.0 << " ";
     }
+    std::cerr << std::endl;
+    std::cerr << " Upgrade ratio (to +20): ";
+    for (int i = 0; i < SLOT_CT; i++) {
+      std::cerr << print_percentage(stats.upgrade_ratio[i][0], stats.upgrade_ratio[i][1]) << "% ";
+    }
+    std::cerr << std::endl;
+  }
+  std::cerr << std::endl;
+}
+
+void print_statistics(const RollAccumulator& acc) {
+  int64_t double_crit[SLOT_CT] = {0, 0, 0, 0, 0};
+  for (int i = 0; i < SLOT_CT; i++) {
+    for (int j = 0; j < MAINSTAT_CT; j++)
+      double_crit[i] += acc.double_crit[i][j];
   }
   std::cerr << "Probability of getting an artifact with both crit substats, by slot: " << std::endl;
-  std::cerr << print_percentage(double_crit[0], size) << "% "
-            << print_percentage(double_crit[1], size) << "% "
-            << print_percentage(double_crit[2], size) << "% "
-            << print_percentage(double_crit[3], size) << "% "
-            << print_percentage(double_crit[4], size) << "%" << std::endl;
+  std::cerr << print_percentage(double_crit[0], acc.count) << "% "
+            << print_percentage(double_crit[1], acc.count) << "% "
+            << print_percentage(double_crit[2], acc.count) << "% "
+            << print_percentage(double_crit[3], acc.count) << "% "
+            << print_percentage(double_crit[4], acc.count) << "%" << std::endl;
   std::cerr << std::endl;
+
+  // Crit value is in tenths of a percent
+  std::cerr << "By slot and mainstat: share of the slot's pieces, pieces with both crit substats, and the\n"
+            << "mean / median / 99%ile of crit value (2*CR + CD from substats), score, and good rolls" << std::endl;
+  std::cerr << std::left << std::setw(8) << "Slot" << std::setw(28) << "Mainstat" << std::setw(8) << "Share"
+            << std::setw(13) << "Double crit" << std::setw(20) << "Crit value" << std::setw(20) << "Score"
+            << "Good rolls" << std::endl;
+  for (int i = 0; i < SLOT_CT; i++) {
+    int64_t slot_pieces = 0;
+    for (int j = 0; j < MAINSTAT_CT; j++)
+      slot_pieces += acc.crit_value[i][j].total();
+    for (int j = 0; j < MAINSTAT_CT; j++) {
+      const int64_t pieces = acc.crit_value[i][j].total();
+      if (pieces == 0) continue;
+      std::cerr << std::setw(8) << print_slot(static_cast<Slot>(i)) << std::setw(28) << print_stat(static_cast<Stat>(j))
+                << std::setw(8) << print_share(pieces, slot_pieces)
+                << std::setw(13) << print_share(acc.double_crit[i][j], pieces)
+                << std::setw(20) << print_distribution(acc.crit_value[i][j], 10.0)
+                << std::setw(20) << print_distribution(acc.score[i][j], 1.0)
+                << print_distribution(acc.good_rolls[i][j], 1.0) << std::endl;
+    }
+  }
+  std::cerr << std::right << std::endl;
 }
 
 void print_character(Character& c, Weapon& w) {
@@ -369,7 +593,25 @@ double print_stat_value(Stat s, int v) {
   return v / 10.0;
 }
 
-double print_percentage(int num, int denom) {
+std::string print_generator(Generator g) {
+  if (g == GENERATOR_CANDIDATES) return "candidates";
+  return (g == GENERATOR_BATCH) ? "batch" : "scalar";
+}
+
+bool read_generator(const std::string& name, Generator* g) {
+  if (name == "scalar") {
+    *g = GENERATOR_SCALAR;
+  } else if (name == "batch") {
+    *g = GENERATOR_BATCH;
+  } else if (name == "candidates") {
+    *g = GENERATOR_CANDIDATES;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+double print_percentage(int64_t num, int64_t denom) {
   double percentage = 100.0 * num / denom;
   return round(percentage * 100.0) / 100.0;
 }
@@ -384,6 +626,112 @@ std::vector<std::string> split(const std::string &s, char d) {
     return v;
 }
 
+bool write_shard_result(std::string filename, const ShardResult& result) {
+  std::ofstream file(filename);
+  if (!file.is_open()) return false;
+
+  file << "# Genshin artifact sim shard result\n";
+  write_shard_fields(file, result);
+  return file.good();
+}
+
+bool read_shard_result(std::string filename, ShardResult* result) {
+  std::ifstream file(filename);
+  if (!file.is_open()) return false;
+
+  *result = {};
+  std::string line;
+  while (getline(file, line)) {
+    // Ignore comment lines
+    if (line[0] == '#') continue;
+    // Ignore blank lines
+    if (line.empty()) continue;
+
+    if (!read_shard_field(line, result)) {
+      std::cerr << "Invalid line " << line << std::endl;
+      return false;
+    }
+  }
+
+  // Callers index per-shard state with the shard, so reject files naming a shard outside the run
+  return !result->command.empty() && result->shard >= 0 && result->shard < result->shard_ct;
+}
+
+bool replace_file(const std::string& tmp_filename, const std::string& filename) {
+#ifdef _WIN32
+  // rename fails on Windows if the target exists
+  return MoveFileExA(tmp_filename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+#endif
+}
+
+bool write_checkpoint(std::string filename, const ScriptCheckpoint& checkpoint) {
+  // Write to a temporary file and rename it over the old checkpoint, so that an interruption
+  // never leaves a partially written checkpoint behind
+  const std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream file(tmp_filename, std::ios::trunc);
+    if (!file.is_open()) return false;
+
+    file << "# Genshin artifact sim farm_script checkpoint\n";
+    file << "start_n=" << checkpoint.start_n << "\n";
+    file << "stop_n=" << checkpoint.stop_n << "\n";
+    file << "step=" << checkpoint.step << "\n";
+    file << "cache=" << (checkpoint.use_drop_cache ? std::to_string(checkpoint.drop_cache_seed) : "off") << "\n";
+    const BootstrapSettings& bootstrap = checkpoint.bootstrap;
+    file << "bootstrap=" << ((bootstrap.drops > 0) ? std::to_string(bootstrap.drops) + "," + std::to_string(bootstrap.replicates)
+                                                       + (bootstrap.windows ? ",windows" : ",replacement")
+                                                   : "off") << "\n";
+    write_shard_fields(file, checkpoint.result);
+    file.flush();
+    if (!file.good()) return false;
+  }
+  return replace_file(tmp_filename, filename);
+}
+
+bool read_checkpoint(std::string filename, ScriptCheckpoint* checkpoint) {
+  std::ifstream file(filename);
+  if (!file.is_open()) return false;
+
+  *checkpoint = {};
+  std::string line;
+  while (getline(file, line)) {
+    // Ignore comment lines
+    if (line[0] == '#') continue;
+    // Ignore blank lines
+    if (line.empty()) continue;
+
+    std::vector<std::string> kv_pair = split(line, '=');
+    const std::string& key = kv_pair[0];
+    if (kv_pair.size() == 2 && key == "start_n") {
+      checkpoint->start_n = std::stoi(kv_pair[1]);
+    } else if (kv_pair.size() == 2 && key == "stop_n") {
+      checkpoint->stop_n = std::stoi(kv_pair[1]);
+    } else if (kv_pair.size() == 2 && key == "step") {
+      checkpoint->step = std::stoi(kv_pair[1]);
+    } else if (kv_pair.size() == 2 && key == "cache") {
+      checkpoint->use_drop_cache = (kv_pair[1] != "off");
+      if (checkpoint->use_drop_cache) checkpoint->drop_cache_seed = std::stoull(kv_pair[1]);
+    } else if (kv_pair.size() == 2 && key == "bootstrap") {
+      const std::vector<std::string> fields = split(kv_pair[1], ',');
+      if (fields.size() == 3) {
+        checkpoint->bootstrap = {std::stoll(fields[0]), std::stoi(fields[1]), fields[2] == "windows"};
+      } else if (kv_pair[1] != "off") {
+        std::cerr << "Invalid line " << line << std::endl;
+        return false;
+      }
+    } else if (kv_pair.size() == 2 && key == "done") {
+      // Written by older versions. The accumulator counts hold the same.
+    } else if (!read_shard_field(line, &checkpoint->result)) {
+      std::cerr << "Invalid line " << line << std::endl;
+      return false;
+    }
+  }
+
+  return checkpoint->result.command == "farm_script" && checkpoint->step > 0;
+}
+
 bool read_main_config(MainConfig* mcfg) {
   std::ifstream config("config/main.cfg");
   if (!config.is_open()) return false;
@@ -420,7 +768,10 @@ bool read_main_config(MainConfig* mcfg) {
 bool read_character_config(std::string filename, Character* c) {
   std::ifstream config("config/characters/" + filename + ".cfg");
   if (!config.is_open()) return false;
+  return read_character_config(config, c);
+}
 
+bool read_character_config(std::istream& config, Character* c) {
   // Clear character config
   *c = {};
 
@@ -482,10 +833,117 @@ bool read_character_config(std::string filename, Character* c) {
   return true;
 }
 
+bool write_character_config(std::string filename, Character& c) {
+  std::ofstream config("config/characters/" + filename + ".cfg");
+  if (!config.is_open()) return false;
+
+  auto stat_key = [](Stat s) {
+    auto it = std::find_if(
+        stat_parse.begin(), stat_parse.end(),
+        [&s](const std::pair<std::string, Stat>& p) {
+          return p.second == s;
+        });
+    return it->first;
+  };
+
+  config << "base_atk=" << c.base_atk << "\n";
+  config << "reaction_multiplier=" << c.reaction_multiplier_x10 / 10.0 << "\n";
+  config << "reaction_percentage=" << c.reaction_percentage << "\n";
+  config << "damage_type=" << stat_key(c.damage_type) << "\n\n";
+  for (int i = 0; i < STAT_CT; i++) {
+    config << stat_key(static_cast<Stat>(i)) << "=" << double(c.stats[i]) / STAT_MULTIPLIER[i] << "\n";
+  }
+
+  const FarmingConfig& fcfg = c.farming_config;
+  config << "\nfarming_config {\ndomains=";
+  for (unsigned int i = 0; i < fcfg.domains.size(); i++) {
+    const Domain d = fcfg.domains[i];
+    auto it = std::find_if(
+        domain_parse.begin(), domain_parse.end(),
+        [&d](const std::pair<std::string, Domain>& p) {
+          return p.second == d;
+        });
+    config << (i > 0 ? "," : "") << it->first;
+  }
+  config << "\n\n";
+
+  const std::string set_keys[SET_PIECES_CT] = {"target_sets_2pc", "target_sets_4pc"};
+  for (int pieces = 0; pieces < SET_PIECES_CT; pieces++) {
+    std::string sets = "";
+    for (int i = 0; i < SET_CT; i++) {
+      if (!fcfg.target_sets[i][pieces]) continue;
+      sets += (sets.empty() ? "" : ",") + print_set(static_cast<Set>(i));
+    }
+    // An empty list is not valid config syntax
+    if (!sets.empty()) config << set_keys[pieces] << "=" << sets << "\n";
+  }
+  config << "\n";
+
+  for (int i = 0; i < MAINSTAT_CT; i++) {
+    config << stat_key(static_cast<Stat>(i)) << "=" << fcfg.stat_score[i] << "\n";
+  }
+  config << "\nstat_score_max=" << fcfg.stat_score_max << "\n";
+  if (fcfg.derive_stat_score) config << "derive_stat_score=true\n";
+  config << "mainstat_multiplier=" << fcfg.mainstat_multiplier << "\n";
+  config << "set_bonus_value=" << fcfg.set_bonus_value << "\n";
+  config << "min_stat_score=";
+  for (int i = 0; i < SLOT_CT; i++) {
+    config << (i > 0 ? "," : "") << fcfg.min_stat_score[i];
+  }
+  config << "\n\n";
+  for (const StatConstraint& constraint : fcfg.constraints) {
+    const double multiplier = STAT_MULTIPLIER[constraint.stat];
+    if (constraint.min != std::numeric_limits<int>::min()) {
+      config << (constraint.stat == ER ? "required_er" : "min_" + stat_key(constraint.stat))
+             << "=" << constraint.min / multiplier << "\n";
+    }
+    if (constraint.max != std::numeric_limits<int>::max())
+      config << "max_" << stat_key(constraint.stat) << "=" << constraint.max / multiplier << "\n";
+  }
+  config << "}\n";
+
+  return config.good();
+}
+
+std::vector<std::string> list_configs(std::string type) {
+  const std::string extension = ".cfg";
+  std::vector<std::string> files;
+#ifdef _WIN32
+  _finddata_t entry;
+  intptr_t handle = _findfirst(("config/" + type + "/*" + extension).c_str(), &entry);
+  if (handle != -1) {
+    do {
+      files.push_back(entry.name);
+    } while (_findnext(handle, &entry) == 0);
+    _findclose(handle);
+  }
+#else
+  DIR* dir = opendir(("config/" + type).c_str());
+  if (dir != nullptr) {
+    while (dirent* entry = readdir(dir))
+      files.push_back(entry->d_name);
+    closedir(dir);
+  }
+#endif
+
+  std::vector<std::string> names;
+  for (const std::string& file : files) {
+    if (file.size() <= extension.size()
+        || file.compare(file.size() - extension.size(), extension.size(), extension) != 0) continue;
+    const std::string name = file.substr(0, file.size() - extension.size());
+    if (name != "template") names.push_back(name);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
 bool read_weapon_config(std::string filename, Weapon* w) {
   std::ifstream config("config/weapons/" + filename + ".cfg");
   if (!config.is_open()) return false;
+  return read_weapon_config(config, w);
+}
 
+bool read_weapon_config(std::istream& config, Weapon* w) {
   // Clear weapon config
   *w = {};
 
@@ -524,3 +982,67 @@ bool read_weapon_config(std::string filename, Weapon* w) {
 
   return true;
 }
+
+bool read_policy_config(std::string filename, FarmingConfig& fcfg, std::vector<UpgradePolicy>* policies) {
+  std::ifstream config("config/policies/" + filename + ".cfg");
+  if (!config.is_open()) return false;
+
+  policies->clear();
+  UpgradePolicy policy;
+  bool in_policy = false;
+
+  std::string line;
+  while (getline(config, line)) {
+    // Ignore comment lines
+    if (line[0] == '#') continue;
+    // Ignore blank lines
+    if (line.empty()) continue;
+
+    if (line == "policy {") {
+      // Start a new policy using the farming config thresholds at +0
+      policy = {};
+      policy.name = "policy " + std::to_string(policies->size() + 1);
+      for (int i = 0; i < SLOT_CT; i++)
+        policy.min_stat_score[0][i] = fcfg.min_stat_score[i];
+      in_policy = true;
+      continue;
+    }
+    if (line == "}") {
+      if (in_policy) policies->push_back(policy);
+      in_policy = false;
+      continue;
+    }
+
+    std::vector<std::string> kv_pair = split(line, '=');
+    // Ignore invalid lines
+    if (kv_pair.size() < 2 || !in_policy) {
+      std::cerr << "Warning: invalid line " << line << std::endl;
+      continue;
+    };
+    const std::string& key = kv_pair[0];
+    const std::string& value = kv_pair[1];
+
+    if (key == "name") {
+      policy.name = value;
+    } else if (key.compare(0, 6, "stage_") == 0) {
+      int level = std::stoi(key.substr(6));
+      if (level % 4 != 0 || level < 0 || level / 4 >= UPGRADE_STAGE_CT) {
+        std::cerr << "Invalid upgrade stage " << key << std::endl;
+        return false;
+      }
+      const auto min_score_list = split(value, ',');
+      if (min_score_list.size() < SLOT_CT) {
+        std::cerr << "Not enough values in " << key << " list." << std::endl;
+        return false;
+      }
+      for (int i = 0; i < SLOT_CT; i++) {
+        policy.min_stat_score[level / 4][i] = std::stoi(min_score_list[i]);
+      }
+    } else {
+      std::cerr << "Unknown key " << key << std::endl;
+      return false;
+    }
+  }
+
+  return !policies->empty();
+}
@@ -1,18 +1,29 @@
 #ifndef __TEXT_IO_H__
 #define __TEXT_IO_H__
 
+#include <istream>
+#include <ostream>
 #include <string>
 #include <vector>
 
+#include "analyze.h"
 #include "farm.h"
+#include "policy.h"
 #include "types.h"
 
 // Print some statistics about a profile of damage achieved across a population.
-// Modifies damage_achieved.
 void print_statistics(Character& c, std::vector<FarmedSet>& all_max_sets);
+void print_statistics(const FarmedSetStats& stats);
 
-// Print some basic statistics about a sample of +20 artifacts.
-void print_statistics(Artifact* sample, int size);
+// Header line and one row of the farm_script output.csv file.
+extern const char* const STATS_CSV_HEADER;
+void write_stats_row(std::ostream& out, int n, const FarmedSetStats& stats);
+
+// Print a comparison of the damage achieved and artifact EXP spent by each upgrade policy.
+void print_statistics(Character& c, std::vector<UpgradePolicy>& policies, std::vector<PolicyResult>& results);
+
+// Print the distributions of the +20 artifacts rolled by the roll command.
+void print_statistics(const RollAccumulator& acc);
 
 // Print overall stats for a character (attack, total cr, total cd, etc.) with or without artifacts.
 void print_character(Character& c, Weapon& w);
@@ -26,16 +37,40 @@ std::string print_slot(Slot s);
 std::string print_stat(Stat s);
 std::string print_set(Set s);
 double print_stat_value(Stat s, int v);
-double print_percentage(int num, int denom);
+double print_percentage(int64_t num, int64_t denom);
+std::string print_generator(Generator g);
+// Parses a generator name as printed by print_generator. Returns false if invalid.
+bool read_generator(const std::string& name, Generator* g);
 
 // Splits a string s with delimiter d.
 std::vector<std::string> split(const std::string &s, char d);
 
+// Write and read the partial results of one shard of a run.
+bool write_shard_result(std::string filename, const ShardResult& result);
+bool read_shard_result(std::string filename, ShardResult* result);
+// Rename tmp_filename over filename in one step, so that filename always holds either the old or the
+// new contents, even if the process is interrupted.
+bool replace_file(const std::string& tmp_filename, const std::string& filename);
+// Atomically replace the checkpoint file of a farm_script run, and read it back.
+bool write_checkpoint(std::string filename, const ScriptCheckpoint& checkpoint);
+bool read_checkpoint(std::string filename, ScriptCheckpoint* checkpoint);
+
 // Read the main config
 bool read_main_config(MainConfig* mcfg);
 // Read a character config from relative path config/characters/<filename>.cfg
 bool read_character_config(std::string filename, Character* c);
+// Read a character config in the same format from any stream
+bool read_character_config(std::istream& config, Character* c);
+// Write a character config to relative path config/characters/<filename>.cfg
+bool write_character_config(std::string filename, Character& c);
+// List the configs in relative path config/<type>/ by name, sorted, leaving out the template
+std::vector<std::string> list_configs(std::string type);
 // Read a weapon config from relative path config/weapons/<filename>.cfg
 bool read_weapon_config(std::string filename, Weapon* w);
+// Read a weapon config in the same format from any stream
+bool read_weapon_config(std::istream& config, Weapon* w);
+// Read a list of upgrade policies from relative path config/policies/<filename>.cfg
+// Stages not given in a policy default to the +0 thresholds in fcfg and no threshold after.
+bool read_policy_config(std::string filename, FarmingConfig& fcfg, std::vector<UpgradePolicy>* policies);
 
 #endif
@@ -0,0 +1,34 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads running submitted tasks in FIFO order.
+// The destructor finishes all queued tasks before joining the workers.
+class ThreadPool {
+ public:
+  // Starts the given number of workers, or one per hardware thread if threads <= 0.
+  explicit ThreadPool(int threads);
+  ThreadPool(const ThreadPool& other) = delete;
+  ThreadPool& operator=(const ThreadPool& other) = delete;
+  ~ThreadPool();
+
+  void submit(std::function<void()> task);
+  int size() const { return (int) workers.size(); }
+
+ private:
+  void work();
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable task_available;
+  bool stopping;
+};
+
+#endif
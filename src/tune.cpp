@@ -0,0 +1,137 @@
+#include "tune.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "farm.h"
+#include "gen_artifact.h"
+
+namespace {
+
+// Number of random candidates tried in the coarse search, and around the best coarse candidate.
+constexpr int COARSE_CANDIDATE_CT = 64;
+constexpr int FINE_CANDIDATE_CT = 16;
+// Maximum change to each min_stat_score and set_bonus_value in the coarse and fine searches.
+constexpr int COARSE_SPREAD = 12;
+constexpr int FINE_SPREAD = 4;
+// Iterations given to every candidate in the first round of successive halving.
+// Each later round halves the candidates and doubles the iterations.
+constexpr int FIRST_ROUND_ITERS = 16;
+
+struct Candidate {
+  FarmingConfig config;
+  // Damage achieved in each iteration evaluated so far
+  std::vector<int> damage;
+  double objective;
+};
+
+double calc_objective(std::vector<int> damage, TuneObjective objective) {
+  if (objective == TUNE_MEDIAN) {
+    std::sort(damage.begin(), damage.end());
+    return damage[damage.size() / 2];
+  }
+  int64_t damage_total = 0;
+  for (int d : damage)
+    damage_total += d;
+  return double(damage_total) / damage.size();
+}
+
+// Returns a copy of base with randomly perturbed thresholds and set bonus value, farming one of
+// the given domain lists.
+FarmingConfig perturb(const FarmingConfig& base, const std::vector<std::vector<Domain>>& domain_options,
+    int spread, std::mt19937& tune_rng) {
+  FarmingConfig fcfg = base;
+  std::uniform_int_distribution<int> offset_dist(-spread, spread);
+  for (int i = 0; i < SLOT_CT; i++)
+    fcfg.min_stat_score[i] = std::max(0, base.min_stat_score[i] + offset_dist(tune_rng));
+  fcfg.set_bonus_value = std::max(0, base.set_bonus_value + offset_dist(tune_rng));
+
+  std::uniform_int_distribution<int> domain_dist(0, domain_options.size()-1);
+  fcfg.domains = domain_options[domain_dist(tune_rng)];
+  fcfg.domain_idx = 0;
+  return fcfg;
+}
+
+// Runs successive halving over the candidates and returns the index of the winner.
+// Iteration i of every candidate uses the same random substream, so candidates are compared
+// on common random numbers.
+int successive_halving(Character& character, Weapon& weapon, int n, TuneObjective objective,
+    uint64_t master_seed, std::vector<Candidate>& candidates) {
+  Character c = character;
+  std::vector<int> remaining;
+  for (unsigned int i = 0; i < candidates.size(); i++)
+    remaining.push_back(i);
+
+  int iters = FIRST_ROUND_ITERS;
+  while (remaining.size() > 1) {
+    std::cerr << "Evaluating " << remaining.size() << " candidates with " << iters << " iterations each..." << std::endl;
+    for (int idx : remaining) {
+      Candidate& cand = candidates[idx];
+      c.farming_config = cand.config;
+      // Only the iterations not evaluated in earlier rounds need to be run
+      for (int i = cand.damage.size(); i < iters; i++) {
+        cand.damage.push_back(farm(c, weapon, n, master_seed, i).damage);
+      }
+      cand.objective = calc_objective(cand.damage, objective);
+    }
+
+    std::stable_sort(remaining.begin(), remaining.end(), [&candidates](int a, int b) {
+      return candidates[a].objective > candidates[b].objective;
+    });
+    std::cerr << " Best: " << candidates[remaining[0]].objective
+              << " | Cutoff: " << candidates[remaining[(remaining.size()-1) / 2]].objective << std::endl;
+    remaining.resize((remaining.size() + 1) / 2);
+    iters *= 2;
+  }
+  return remaining[0];
+}
+
+}  // namespace
+
+FarmingConfig tune(Character& character, Weapon& weapon, int n, TuneObjective objective) {
+  const FarmingConfig& base = character.farming_config;
+  const uint64_t master_seed = gen_seed();
+  std::mt19937 tune_rng(master_seed);
+
+  // Candidate domain lists: the configured round robin, each domain on its own,
+  // and the round robin with each domain left out.
+  std::vector<std::vector<Domain>> domain_options = {base.domains};
+  if (base.domains.size() > 1) {
+    for (unsigned int i = 0; i < base.domains.size(); i++) {
+      domain_options.push_back({base.domains[i]});
+      if (base.domains.size() > 2) {
+        std::vector<Domain> left_out = base.domains;
+        left_out.erase(left_out.begin() + i);
+        domain_options.push_back(left_out);
+      }
+    }
+  }
+
+  // Coarse search over the whole neighborhood of the current config
+  std::vector<Candidate> candidates(COARSE_CANDIDATE_CT);
+  candidates[0].config = base;
+  for (int i = 1; i < COARSE_CANDIDATE_CT; i++)
+    candidates[i].config = perturb(base, domain_options, COARSE_SPREAD, tune_rng);
+  FarmingConfig best = candidates[successive_halving(character, weapon, n, objective, master_seed, candidates)].config;
+
+  // Fine search close to the best coarse candidate
+  const std::vector<std::vector<Domain>> best_domains = {best.domains};
+  std::vector<Candidate> fine_candidates(FINE_CANDIDATE_CT);
+  fine_candidates[0].config = best;
+  for (int i = 1; i < FINE_CANDIDATE_CT; i++)
+    fine_candidates[i].config = perturb(best, best_domains, FINE_SPREAD, tune_rng);
+  const int winner = successive_halving(character, weapon, n, objective, master_seed, fine_candidates);
+
+  // Report the improvement on the iterations the winner was evaluated with
+  Character c = character;
+  Candidate current;
+  for (unsigned int i = 0; i < fine_candidates[winner].damage.size(); i++)
+    current.damage.push_back(farm(c, weapon, n, master_seed, i).damage);
+  std::cerr << "Current config: " << calc_objective(current.damage, objective)
+            << " | Tuned config: " << fine_candidates[winner].objective << std::endl;
+
+  return fine_candidates[winner].config;
+}
@@ -0,0 +1,17 @@
+#ifndef __TUNE_H__
+#define __TUNE_H__
+
+#include "types.h"
+
+// Statistic of the damage distribution that tuning maximizes.
+enum TuneObjective {
+  TUNE_MEAN = 0, TUNE_MEDIAN
+};
+
+// Search for the min_stat_score thresholds, set_bonus_value, and domain round robin that maximize
+// the objective when farming n artifacts, and return the best farming config found.
+// All candidates are compared on the same random substreams, and successive halving drops weak
+// candidates after a few iterations so that most iterations are spent on the close contenders.
+FarmingConfig tune(Character& character, Weapon& weapon, int n, TuneObjective objective);
+
+#endif
@@ -127,7 +127,7 @@ Artifact* get_artifact_storage(int size) {
   return artifacts;
 }
 
-int FarmingConfig::score(Artifact& a) {
+int FarmingConfig::score(const Artifact& a) {
   int subs = (a.extra_substat || a.level >= 4) ? 4 : 3;
   int score = mainstat_multiplier * stat_score[a.mainstat];
   if (target_sets[a.set][TWO_PC] || target_sets[a.set][FOUR_PC])
@@ -139,6 +139,19 @@ int FarmingConfig::score(Artifact& a) {
   return score;
 }
 
-bool FarmingConfig::upgradeable(Artifact& a) {
+bool FarmingConfig::upgradeable(const Artifact& a) {
   return score(a) >= min_stat_score[a.slot];
 }
+
+ScoreTable::ScoreTable(const FarmingConfig& fcfg) {
+  for (int i = 0; i < MAINSTAT_CT; i++)
+    mainstat[i] = fcfg.mainstat_multiplier * fcfg.stat_score[i];
+  for (int i = 0; i < SET_CT; i++)
+    set[i] = (fcfg.target_sets[i][TWO_PC] || fcfg.target_sets[i][FOUR_PC]) ? fcfg.set_bonus_value : 0;
+  for (int i = 0; i < SUBSTAT_CT; i++) {
+    substat_offset[i] = substat.size();
+    // Same integer estimate of the number of good rolls as FarmingConfig::score
+    for (int v = 0; v <= MAX_SUBSTAT_ROLLS * SUBSTAT_LEVEL[i][3]; v++)
+      substat.push_back(fcfg.stat_score[i] * v / SUBSTAT_LEVEL[i][0]);
+  }
+}
@@ -99,6 +99,14 @@ struct Artifact {
 // Get a dynamically allocated array of zero-initialized Artifacts.
 Artifact* get_artifact_storage(int size);
 
+// Bounds on the total of a stat from the character, weapon, and artifact main and substats
+// (not set effects) that the optimized set must satisfy.
+struct StatConstraint {
+  Stat stat;
+  int min;
+  int max;
+};
+
 // Stores the parameters governing player behavior when farming.
 struct FarmingConfig {
   // All domains to farm in a round robin
@@ -113,6 +121,9 @@ struct FarmingConfig {
   int stat_score[MAINSTAT_CT];
   // The max value present in stat_score. This controls heuristics for finding the artifact set with highest damage.
   int stat_score_max;
+  // If true, stat_score is replaced by weights derived from the damage formula for the chosen weapon,
+  // scaled so that the most valuable stat is worth stat_score_max. See derive_stat_weights in farm.h.
+  bool derive_stat_score;
   // The number of substat rolls that a correct mainstat is worth. Usually 6-8 is a good estimate.
   int mainstat_multiplier;
   // The score that an onset piece is worth.
@@ -121,8 +132,9 @@ struct FarmingConfig {
   // The minimum score necessary at +0 for an artifact to be leveled to +20
   int min_stat_score[SLOT_CT];
 
-  // Total ER required for the character, set to 100% if no ER is required.
-  int required_er;
+  // Minimums or caps on stats, e.g. total ER required for the character. A set failing any
+  // of them is never chosen. At most one constraint per stat.
+  std::vector<StatConstraint> constraints;
 
   Domain next_domain() {
     Domain d = domains[domain_idx];
@@ -132,10 +144,34 @@ struct FarmingConfig {
 
   // Returns an overall stat score for the given artifact, based on number of good sub rolls
   // calculated by weights given in the stat_score array.
-  int score(Artifact& a);
+  int score(const Artifact& a);
 
   // Returns whether the artifact should be leveled to +20
-  bool upgradeable(Artifact& a);
+  bool upgradeable(const Artifact& a);
+};
+
+// Most rolls a substat line can get: its first roll, and every upgrade of a piece with 4 lines at +0
+constexpr int MAX_SUBSTAT_ROLLS = 6;
+
+// FarmingConfig::score as table lookups: the score of every mainstat, set, and value of every substat,
+// so that scoring takes no divisions. Gives the same scores as the config it was built from, for
+// artifacts whose lines have at most MAX_SUBSTAT_ROLLS rolls.
+struct ScoreTable {
+  int mainstat[MAINSTAT_CT];
+  int set[SET_CT];
+  // The score of value v of substat s is at substat[substat_offset[s] + v]
+  int substat_offset[SUBSTAT_CT];
+  std::vector<int> substat;
+
+  explicit ScoreTable(const FarmingConfig& fcfg);
+
+  int score(const Artifact& a) const {
+    const int subs = (a.extra_substat || a.level >= 4) ? 4 : 3;
+    int total = mainstat[a.mainstat] + set[a.set];
+    for (int i = 0; i < subs; i++)
+      total += substat[substat_offset[a.substats[i]] + a.substat_values[a.substats[i]]];
+    return total;
+  }
 };
 
 // Stores the stats profile for a character and weapon.
@@ -0,0 +1,246 @@
+#include "verify.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <random>
+
+#include "farm.h"
+#include "gen_artifact.h"
+
+namespace {
+
+enum PoolClass {
+  POOL_RANDOM = 0,
+  POOL_RANDOM_LARGE,
+  POOL_SHUFFLED,
+  POOL_SET_TRADEOFF,
+  POOL_DUPLICATES,
+  POOL_CONSTRAINED,
+  POOL_CLASS_CT
+};
+
+const char* const POOL_CLASS_NAMES[POOL_CLASS_CT] = {
+  "random", "random_large", "shuffled", "set_tradeoff", "duplicates", "constrained"
+};
+
+// Pieces added to the large slot of a large pool beyond the fewest that reach MEET_IN_THE_MIDDLE_MIN_SETS
+constexpr int LARGE_SLOT_EXTRA = 10;
+
+bool same_artifact(const Artifact& a, const Artifact& b) {
+  return a.slot == b.slot && a.mainstat == b.mainstat && a.set == b.set
+         && std::equal(a.substat_values, a.substat_values + SUBSTAT_CT, b.substat_values);
+}
+
+// Returns the first set in the farming config's targets with the given bonus, or NONE.
+Set find_target_set(const FarmingConfig& fcfg, SetPieces pieces) {
+  for (int i = 0; i < SET_CT; i++) {
+    if (fcfg.target_sets[i][pieces]) return static_cast<Set>(i);
+  }
+  return NONE;
+}
+
+// Returns a set that is not a target of the farming config.
+Set find_off_set(const FarmingConfig& fcfg) {
+  for (int i = SET_CT - 1; i > 0; i--) {
+    if (!fcfg.target_sets[i][TWO_PC] && !fcfg.target_sets[i][FOUR_PC]) return static_cast<Set>(i);
+  }
+  return NONE;
+}
+
+// Generates +20 pieces from the farming config's domains until every slot has size[slot] pieces
+// without a useless mainstat, and scores them.
+std::vector<Artifact> gen_pool(FarmingConfig& fcfg, const int* size) {
+  std::vector<Artifact> pool;
+  int count[SLOT_CT] = {};
+  int missing = 0;
+  for (int i = 0; i < SLOT_CT; i++)
+    missing += size[i];
+  while (missing > 0) {
+    Artifact a;
+    gen_random(&a, fcfg);
+    if (count[a.slot] >= size[a.slot]) continue;
+    if (a.slot >= SANDS && fcfg.stat_score[a.mainstat] == 0) continue;
+    upgrade_full(&a);
+    a.stat_score = fcfg.score(a);
+    pool.push_back(a);
+    count[a.slot]++;
+    missing--;
+  }
+  return pool;
+}
+
+// Total ER of the character, weapon, and set.
+int total_er(Character& character, Weapon& weapon, const Artifact* set) {
+  int total = character.stats[ER] + weapon.stats[ER];
+  for (int i = 0; i < SLOT_CT; i++)
+    total += ((set[i].mainstat == ER) ? MAINSTAT_LEVEL[ER] : 0) + set[i].substat_values[ER];
+  return total;
+}
+
+// Runs both searches on the pool and adds the comparison to result.
+void compare_searches(Character& character, Weapon& weapon, std::vector<Artifact>& pool, int pool_idx,
+                      VerifyResult* result) {
+  int size[SLOT_CT] = {};
+  for (const Artifact& a : pool)
+    size[a.slot]++;
+  const bool exact_search = uses_meet_in_the_middle(size);
+
+  FarmedSet reference;
+  auto start = std::chrono::steady_clock::now();
+  reference_optimize_set(character, weapon, pool.data(), (int) pool.size(), &reference);
+  auto end = std::chrono::steady_clock::now();
+  result->reference_seconds += std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count();
+
+  // Give optimize_set its own copy of the pool
+  std::vector<Artifact> candidates = pool;
+  FarmedSet fast;
+  start = std::chrono::steady_clock::now();
+  optimize_set(character, weapon, candidates.data(), (int) candidates.size(), &fast);
+  end = std::chrono::steady_clock::now();
+  result->seconds += std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count();
+
+  // The meet in the middle search must find the same set on several threads
+  if (exact_search) {
+    candidates = pool;
+    FarmedSet parallel;
+    set_search_threads(VERIFY_SEARCH_THREADS);
+    optimize_set(character, weapon, candidates.data(), (int) candidates.size(), &parallel);
+    set_search_threads(1);
+    bool same = parallel.damage == fast.damage;
+    for (int i = 0; i < SLOT_CT; i++)
+      same = same && same_artifact(parallel.artifacts[i], fast.artifacts[i]);
+    if (!same) result->parallel_mismatches++;
+  }
+
+  // The approximate optimizer's set must be within the gap of the best set, which its bound must not be below
+  candidates = pool;
+  FarmedSet approx;
+  set_optimizer_gap(VERIFY_APPROX_GAP, 0);
+  optimize_set(character, weapon, candidates.data(), (int) candidates.size(), &approx);
+  set_optimizer_gap(0.0, 0);
+  const bool approx_valid = approx.damage == 0
+      || (set_damage(character, weapon, approx.artifacts) == approx.damage
+          && satisfies_constraints(character, weapon, approx.artifacts));
+  if (!approx_valid || approx.damage > reference.damage || approx.damage_bound < reference.damage
+      || approx.damage < (1.0 - VERIFY_APPROX_GAP) * reference.damage) {
+    result->approx_violations++;
+  }
+
+  result->pools++;
+  const bool invalid = fast.damage > reference.damage
+      || (fast.damage > 0 && (set_damage(character, weapon, fast.artifacts) != fast.damage
+                              || !satisfies_constraints(character, weapon, fast.artifacts)));
+  if (invalid) {
+    result->invalid_results++;
+  } else if (fast.damage < reference.damage) {
+    if (exact_search) {
+      result->exact_mismatches++;
+    } else {
+      result->margin_misses++;
+    }
+  } else {
+    for (int i = 0; i < SLOT_CT; i++) {
+      if (!same_artifact(fast.artifacts[i], reference.artifacts[i])) {
+        result->argmax_ties++;
+        break;
+      }
+    }
+    return;
+  }
+  result->mismatches.push_back({pool_idx, fast.damage, reference.damage, exact_search});
+}
+
+}  // namespace
+
+std::vector<VerifyResult> verify_optimizer(Character& character, Weapon& weapon, int pools, uint64_t master_seed) {
+  FarmingConfig& fcfg = character.farming_config;
+  const Set four_pc_set = (find_target_set(fcfg, FOUR_PC) != NONE) ? find_target_set(fcfg, FOUR_PC)
+                                                                    : find_target_set(fcfg, TWO_PC);
+  const Set off_set = find_off_set(fcfg);
+
+  std::vector<VerifyResult> results;
+  for (int pool_class = 0; pool_class < POOL_CLASS_CT; pool_class++) {
+    VerifyResult result = {POOL_CLASS_NAMES[pool_class], 0, 0, 0, 0, 0, 0, 0, 0.0, 0.0, {}};
+    for (int p = 0; p < pools; p++) {
+      const uint64_t pool_seed = iteration_seed(master_seed, (uint64_t) pool_class * pools + p);
+      seed(pool_seed);
+      fcfg.domain_idx = 0;
+      std::default_random_engine size_rng(pool_seed);
+      std::uniform_int_distribution<int> small_dist(3, 12), large_other_dist(3, 8);
+      std::uniform_int_distribution<int> large_dist(0, LARGE_SLOT_EXTRA), slot_dist(0, SLOT_CT - 1);
+
+      // Small pools, or pools with one slot just large enough for the meet in the middle search,
+      // counting the copies of every piece the duplicates class adds
+      const bool large = (pool_class == POOL_RANDOM_LARGE) || (pool_class != POOL_RANDOM && p % 2 == 1);
+      int size[SLOT_CT];
+      for (int i = 0; i < SLOT_CT; i++)
+        size[i] = large ? large_other_dist(size_rng) : small_dist(size_rng);
+      if (large) {
+        const int large_slot = slot_dist(size_rng);
+        const int copies = (pool_class == POOL_DUPLICATES) ? 3 : 1;
+        int64_t other_sets = copies;
+        for (int i = 0; i < SLOT_CT; i++) {
+          if (i != large_slot) other_sets *= copies * size[i];
+        }
+        size[large_slot] = (int) ((MEET_IN_THE_MIDDLE_MIN_SETS + other_sets - 1) / other_sets) + large_dist(size_rng);
+      }
+      std::vector<Artifact> pool = gen_pool(fcfg, size);
+
+      Character tested = character;
+      if (pool_class == POOL_SHUFFLED) {
+        std::vector<int> scores;
+        for (const Artifact& a : pool)
+          scores.push_back(a.stat_score);
+        std::shuffle(scores.begin(), scores.end(), size_rng);
+        for (unsigned int i = 0; i < pool.size(); i++)
+          pool[i].stat_score = scores[i];
+      } else if (pool_class == POOL_SET_TRADEOFF) {
+        for (unsigned int i = 0; i < pool.size(); i++) {
+          Artifact& a = pool[i];
+          if (i % 3 == 0) {
+            a.set = four_pc_set;
+            for (int j = 0; j < 4; j++)
+              a.substat_values[a.substats[j]] = SUBSTAT_LEVEL[a.substats[j]][0];
+          } else {
+            a.set = off_set;
+          }
+          a.stat_score = fcfg.score(a);
+        }
+      } else if (pool_class == POOL_DUPLICATES) {
+        const unsigned int original_size = pool.size();
+        for (unsigned int i = 0; i < original_size; i++) {
+          Artifact copy = pool[i];
+          pool.push_back(copy);
+          copy.set = off_set;
+          copy.stat_score = fcfg.score(copy);
+          pool.push_back(copy);
+        }
+      } else if (pool_class == POOL_CONSTRAINED) {
+        // Require slightly more ER than the unconstrained best set has, replacing any ER constraint
+        FarmedSet unconstrained;
+        Character relaxed = character;
+        relaxed.farming_config.constraints.clear();
+        reference_optimize_set(relaxed, weapon, pool.data(), (int) pool.size(), &unconstrained);
+        std::vector<StatConstraint>& constraints = tested.farming_config.constraints;
+        constraints.erase(std::remove_if(constraints.begin(), constraints.end(),
+                                         [](const StatConstraint& c) { return c.stat == ER; }),
+                          constraints.end());
+        constraints.push_back({ER, total_er(character, weapon, unconstrained.artifacts) + 1,
+                               std::numeric_limits<int>::max()});
+      }
+
+      compare_searches(tested, weapon, pool, p, &result);
+    }
+    results.push_back(result);
+  }
+  return results;
+}
+
+bool verification_passed(const std::vector<VerifyResult>& results) {
+  for (const VerifyResult& result : results) {
+    if (result.exact_mismatches > 0 || result.invalid_results > 0 || result.parallel_mismatches > 0
+        || result.approx_violations > 0) return false;
+  }
+  return true;
+}
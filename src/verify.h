@@ -0,0 +1,66 @@
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+// Differential validation of optimize_set against reference_optimize_set, its exhaustive search
+// without pruning, on pools of +20 artifacts small enough to search exhaustively.
+
+// Threads the meet in the middle search is also run on, to compare with its result on one thread
+constexpr int VERIFY_SEARCH_THREADS = 4;
+// Gap the approximate optimizer is also run with, to check its set and certified bound against the reference
+constexpr double VERIFY_APPROX_GAP = 0.02;
+
+// A pool where optimize_set's result differs from the reference.
+struct VerifyMismatch {
+  int pool;
+  int damage;
+  int reference_damage;
+  bool exact_search;
+};
+
+// Comparison of both searches on one class of pools.
+struct VerifyResult {
+  std::string pool_class;
+  int pools;
+  // Pools where optimize_set found less damage than the reference with the nested loops, whose
+  // GOOD_ROLLS_MARGIN pruning is allowed to miss the best set
+  int margin_misses;
+  // Pools where optimize_set found less damage with the meet in the middle search, which must be exact
+  int exact_mismatches;
+  // Pools where optimize_set returned more damage than the reference, a damage that isn't the damage of
+  // its set, or a set violating the stat constraints. Always a bug.
+  int invalid_results;
+  // Pools where both found the same damage with different sets
+  int argmax_ties;
+  // Pools where the meet in the middle search found a different set on VERIFY_SEARCH_THREADS threads
+  // than on one. Always a bug.
+  int parallel_mismatches;
+  // Pools where the approximate optimizer returned a set more than VERIFY_APPROX_GAP below the reference,
+  // more than the reference, an invalid set, or a damage bound below the reference. Always a bug.
+  int approx_violations;
+  double seconds;
+  double reference_seconds;
+  std::vector<VerifyMismatch> mismatches;
+};
+
+// Compares the searches on pools per class of pool, generated from seed:
+//   random        3-12 random pieces per slot
+//   random_large  3-8 random pieces in all but one slot, which has just enough pieces for optimize_set
+//                 to use the meet in the middle search
+//   shuffled      random pools with the stat scores shuffled between pieces, like badly chosen stat
+//                 weights, which mislead GOOD_ROLLS_MARGIN pruning
+//   set_tradeoff  a third of the pieces in a target set with minimal substats, the rest off set
+//   duplicates    every piece twice, and once more off set, so that many sets tie
+//   constrained   a minimum ER just above what the unconstrained best set has
+// The last four classes alternate between random and random_large pool sizes.
+std::vector<VerifyResult> verify_optimizer(Character& character, Weapon& weapon, int pools, uint64_t seed);
+// Returns whether none of the results show an exact search mismatch, an invalid result, a parallel
+// mismatch, or an approximation violation.
+bool verification_passed(const std::vector<VerifyResult>& results);
+
+#endif